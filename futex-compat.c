@@ -1,9 +1,8 @@
-// futex-compat.h - Cross-platform futex-like implementation
-#ifndef FUTEX_COMPAT_H
-#define FUTEX_COMPAT_H
-
+// futex-compat.c - Cross-platform futex-like implementation
 #include <stdint.h>
 
+#include "futex-compat.h"
+
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #define NOMINMAX
@@ -11,7 +10,7 @@
 #include <windows.h>
 
 // Windows 8+ has WaitOnAddress which is exactly like futex
-inline long futex_wait_timeout(volatile uint32_t *uaddr, uint32_t expected, int timeout_ms) {
+long futex_wait_timeout(volatile uint32_t *uaddr, uint32_t expected, int timeout_ms) {
     // WaitOnAddress is available on Windows 8+
     // For older Windows, you'd need to use Events or critical sections
     BOOL result = WaitOnAddress(
@@ -23,7 +22,7 @@ inline long futex_wait_timeout(volatile uint32_t *uaddr, uint32_t expected, int
     return result ? 0 : -1;
 }
 
-inline long futex_wake(volatile uint32_t *uaddr, int num_wake) {
+long futex_wake(volatile uint32_t *uaddr, int num_wake) {
     if (num_wake == 1) {
         WakeByAddressSingle((void*)uaddr);
     } else {
@@ -32,6 +31,25 @@ inline long futex_wake(volatile uint32_t *uaddr, int num_wake) {
     return 0;
 }
 
+#elif defined(__APPLE__)
+// Darwin's ulock, what libc++ uses for atomic wait/notify
+#define UL_COMPARE_AND_WAIT 1
+#define ULF_WAKE_ALL 0x00000100
+
+extern int __ulock_wait(uint32_t operation, void *addr, uint64_t value, uint32_t timeout_us);
+extern int __ulock_wake(uint32_t operation, void *addr, uint64_t wake_value);
+
+long futex_wait_timeout(volatile uint32_t *uaddr, uint32_t expected, int timeout_ms) {
+    uint32_t timeout_us = timeout_ms < 0 ? 0 : (uint32_t)timeout_ms * 1000;
+    return __ulock_wait(UL_COMPARE_AND_WAIT, (void *)uaddr, expected, timeout_us);
+}
+
+long futex_wake(volatile uint32_t *uaddr, int num_wake) {
+    uint32_t op = UL_COMPARE_AND_WAIT;
+    if (num_wake != 1) op |= ULF_WAKE_ALL;
+    return __ulock_wake(op, (void *)uaddr, 0);
+}
+
 #else
 // Linux futex
 #include <linux/futex.h>
@@ -40,27 +58,21 @@ inline long futex_wake(volatile uint32_t *uaddr, int num_wake) {
 #include <time.h>
 #include <errno.h>
 
-static inline long futex_wait_timeout(volatile uint32_t *uaddr, uint32_t expected, int timeout_ms) {
+long futex_wait_timeout(volatile uint32_t *uaddr, uint32_t expected, int timeout_ms) {
     if (timeout_ms < 0) {
         return syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, expected, NULL);
     }
     
+    // FUTEX_WAIT takes a relative timeout
     struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    ts.tv_sec  += timeout_ms / 1000;
-    ts.tv_nsec += (timeout_ms % 1000) * 1000000;
-    if (ts.tv_nsec >= 1000000000) {
-        ts.tv_sec++;
-        ts.tv_nsec -= 1000000000;
-    }
+    ts.tv_sec  = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000;
     
     return syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, expected, &ts);
 }
 
-static inline long futex_wake(volatile uint32_t *uaddr, int num_wake) {
+long futex_wake(volatile uint32_t *uaddr, int num_wake) {
     return syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, num_wake);
 }
 
 #endif
-
-#endif // FUTEX_COMPAT_H
@@ -0,0 +1,162 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "latency.h"
+#include "util.h"
+
+// Stamps go from the udp thread to the audio thread through a single
+// producer, single consumer ring; a full ring drops the stamp and counts
+// it. The histograms and the event log are only written by the audio
+// thread, relaxed, and read by latency_show() and latency_show_event() from
+// whichever thread asks.
+
+typedef struct {
+  int client;
+  int port;
+  uint64_t received;
+  uint64_t parsed;
+} latency_stamp_t;
+
+typedef struct {
+  int port;
+  uint64_t count;
+  uint64_t parse_ns;  // received to wire() done, summed
+  uint64_t max_ns;
+  uint64_t bucket[LATENCY_BUCKETS];
+} latency_client_t;
+
+typedef struct {
+  int client;
+  int port;
+  uint64_t sample;    // the first sample rendered with the change
+  uint64_t ns;        // received to that sample being heard
+} latency_event_t;
+
+static struct {
+  volatile int enabled;
+  latency_stamp_t ring[LATENCY_RING];
+  uint64_t head;     // written by the udp thread
+  uint64_t tail;     // written by the audio thread
+  uint64_t dropped;
+  latency_client_t client[LATENCY_CLIENTS];
+  latency_event_t log[LATENCY_LOG];
+  uint64_t logged;   // events ever, the newest is at (logged - 1) % LATENCY_LOG
+} lat = {};
+
+#define LAT_SET(field, v) __atomic_store_n(&(field), (v), __ATOMIC_RELAXED)
+#define LAT_GET(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+void latency_enable(int on) {
+  if (on && !latency_enabled()) __atomic_store_n(&lat.dropped, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&lat.enabled, on ? 1 : 0, __ATOMIC_RELEASE);
+}
+
+int latency_enabled(void) {
+  return __atomic_load_n(&lat.enabled, __ATOMIC_ACQUIRE);
+}
+
+uint64_t latency_now(void) {
+  return util_now();
+}
+
+void latency_post(int client, int port, uint64_t received, uint64_t parsed) {
+  if (!latency_enabled()) return;
+  if (client < 0 || client >= LATENCY_CLIENTS) {
+    __atomic_add_fetch(&lat.dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  const uint64_t head = lat.head;
+  if (head - __atomic_load_n(&lat.tail, __ATOMIC_ACQUIRE) >= LATENCY_RING) {
+    __atomic_add_fetch(&lat.dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  latency_stamp_t *s = &lat.ring[head % LATENCY_RING];
+  s->client = client;
+  s->port = port;
+  s->received = received;
+  s->parsed = parsed;
+  __atomic_store_n(&lat.head, head + 1, __ATOMIC_RELEASE);
+}
+
+// the float's exponent and top two mantissa bits, as for synth_stats()
+static int latency_bucket(uint64_t ns) {
+  const float f = (float)ns;
+  if (!(f >= 0x1p10f)) return 0;
+  uint32_t b;
+  memcpy(&b, &f, sizeof(b));
+  int k = (int)(b >> 21) - ((127 + 10) << 2);
+  return (k < LATENCY_BUCKETS) ? k : LATENCY_BUCKETS - 1;
+}
+
+static double latency_edge(int k) {
+  return ldexp(1.0 + (double)(k & 3) / 4.0, (k >> 2) + 10);
+}
+
+void latency_block(uint64_t sample, uint64_t heard) {
+  const uint64_t head = __atomic_load_n(&lat.head, __ATOMIC_ACQUIRE);
+  uint64_t tail = lat.tail;
+  if (tail == head) return;
+  // turned on partway through a period, which had no start taken
+  if (heard == 0) heard = latency_now();
+  for (; tail < head; tail++) {
+    const latency_stamp_t *s = &lat.ring[tail % LATENCY_RING];
+    latency_client_t *c = &lat.client[s->client];
+    const uint64_t ns = (heard > s->received) ? heard - s->received : 0;
+    const int k = latency_bucket(ns);
+    LAT_SET(c->port, s->port);
+    LAT_SET(c->bucket[k], c->bucket[k] + 1);
+    LAT_SET(c->parse_ns, c->parse_ns + (s->parsed - s->received));
+    if (ns > c->max_ns) LAT_SET(c->max_ns, ns);
+    LAT_SET(c->count, c->count + 1);
+    latency_event_t *e = &lat.log[lat.logged % LATENCY_LOG];
+    LAT_SET(e->client, s->client);
+    LAT_SET(e->port, s->port);
+    LAT_SET(e->sample, sample);
+    LAT_SET(e->ns, ns);
+    LAT_SET(lat.logged, lat.logged + 1);
+  }
+  __atomic_store_n(&lat.tail, tail, __ATOMIC_RELEASE);
+}
+
+static double latency_percentile(const uint64_t *bucket, uint64_t count, double p) {
+  uint64_t want = (uint64_t)ceil(p * (double)count);
+  uint64_t seen = 0;
+  if (want == 0) want = 1;
+  for (int k = 0; k < LATENCY_BUCKETS; k++) {
+    seen += bucket[k];
+    if (seen >= want) return latency_edge(k + 1);
+  }
+  return latency_edge(LATENCY_BUCKETS);
+}
+
+int latency_show(int client, char *out, int size) {
+  if (client < 0) {
+    return snprintf(out, size, "# latency tracing %s, %llu dropped, to when heard less the device's buffer\n",
+      latency_enabled() ? "on" : "off", (unsigned long long)LAT_GET(lat.dropped));
+  }
+  if (client >= LATENCY_CLIENTS) return 0;
+  latency_client_t *c = &lat.client[client];
+  const uint64_t count = LAT_GET(c->count);
+  if (count == 0) return 0;
+  uint64_t bucket[LATENCY_BUCKETS];
+  for (int k = 0; k < LATENCY_BUCKETS; k++) bucket[k] = LAT_GET(c->bucket[k]);
+  const double max = (double)LAT_GET(c->max_ns);
+  return snprintf(out, size,
+    "# client %d port %d: %llu, parse %.3gms, p50 %.3gms p99 %.3gms max %.3gms\n",
+    client, LAT_GET(c->port), (unsigned long long)count,
+    (double)LAT_GET(c->parse_ns) / (double)count / 1e6,
+    fmin(latency_percentile(bucket, count, 0.5), max) / 1e6,
+    fmin(latency_percentile(bucket, count, 0.99), max) / 1e6,
+    max / 1e6);
+}
+
+int latency_show_event(int k, char *out, int size) {
+  const uint64_t logged = LAT_GET(lat.logged);
+  if (k < 0 || k >= LATENCY_LOG || (uint64_t)k >= logged) return 0;
+  const latency_event_t *e = &lat.log[(logged - 1 - k) % LATENCY_LOG];
+  return snprintf(out, size, "# event %llu client %d port %d: %.3gms, at sample %llu\n",
+    (unsigned long long)(logged - 1 - k), LAT_GET(e->client), LAT_GET(e->port),
+    (double)LAT_GET(e->ns) / 1e6, (unsigned long long)LAT_GET(e->sample));
+}
@@ -0,0 +1,42 @@
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <stdint.h>
+
+// Control latency, from a datagram arriving to the first sample that
+// carries what wire() changed. The udp thread stamps the datagrams that
+// changed something audible with latency_post(), and the audio thread picks
+// the stamps up at the start of its next block with latency_block(). That
+// block's first sample is the first rendered entirely after the change. It
+// is heard its offset into the period after the period's first sample, so
+// the time kept is the period's start plus that offset, which leaves out
+// only the device's own buffering. Each client gets a histogram, and the
+// last LATENCY_LOG events keep their sample index. Off by default; while
+// off the udp thread posts nothing and the audio thread does one load a
+// block.
+
+#include "udp.h"
+
+#define LATENCY_CLIENTS (UDP_PORT_MAX)
+#define LATENCY_BUCKETS (80) // 4 to a doubling, from 1us up
+#define LATENCY_RING (256)   // stamps in flight
+#define LATENCY_LOG (16)     // events kept whole, for :m
+
+void latency_enable(int on);
+int latency_enabled(void);
+uint64_t latency_now(void); // ns
+
+// udp thread, once wire() has returned
+void latency_post(int client, int port, uint64_t received, uint64_t parsed);
+
+// audio thread, at the start of a block that begins at sample and is
+// heard at heard (ns on latency_now()'s clock, less the device's buffer)
+void latency_block(uint64_t sample, uint64_t heard);
+
+// a line for the client, -1 for the totals, 0 if the client has none
+int latency_show(int client, char *out, int size);
+
+// a line for the kth most recent event, 0 once there are no more
+int latency_show_event(int k, char *out, int size);
+
+#endif
@@ -0,0 +1,737 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "futex-compat.h"
+#include "util.h"
+#include "skred.h"
+#include "synth-types.h"
+#include "synth.h"
+#include "rec.h"
+
+// The callback copies the recorded voices' stems into a single producer,
+// single consumer ring a frame (every recorded channel) at a time. The
+// writer thread converts whatever has arrived and writes it in large
+// chunks, so the callback never waits on the disk and a recording is only
+// as long as the disk allows. If the writer falls a whole ring behind, the
+// callback drops its period and counts it instead of blocking.
+
+// The header is built once by rec_start() and written ahead of the data,
+// and only its sizes are patched when the recording stops, so a capture of
+// any length needs no second pass:
+//
+//   RIFF WAVE
+//   JUNK       28 bytes, becomes ds64 (RF64) if the file passes 4GB
+//   fmt        WAVE_FORMAT_EXTENSIBLE
+//   fact
+//   bext       Broadcast WAVE, the time reference is skred's sample clock
+//   acid       tempo
+//   cue        a point at sample 0 for every channel
+//   LIST adtl  a labl for each of those ("v3 left"), and a note holding
+//              the voice's voice_format() on its left channel
+//   data
+
+// MAYBE store patterns in a cue note?
+// MAYBE have a user note for pattern that's stored in a queue note
+
+#define REC_CHUNK (1 << 16) // samples converted per write
+#define REC_WAIT_MS (10)
+#define REC_DS64 (12)       // offset of the JUNK / ds64 chunk
+
+// what a header describes, filled in by rec_start() or rec_capture_save()
+typedef struct {
+  int bits;
+  int channels;
+  int count;               // voices, 0 for the master mix
+  const int *voices;
+  uint64_t clock;          // synth_sample_count at the first frame
+  time_t when;             // wall clock at the first frame
+  int fact_at;             // set by rec_header_build()
+  int data_at;
+} rec_format_t;
+
+static struct {
+  volatile uint32_t state; // 1 while the callback feeds the ring
+  volatile uint32_t seen;  // rec_block() calls << 1 | the state the last one saw
+  volatile uint32_t wake;  // bumped to hurry the writer up
+  int offline;             // no device, rec_block() is called by rec_stop()'s thread
+  int running;             // the writer stops once this is 0 and the ring is empty
+  pthread_t thread;
+  FILE *file;
+  int bits;
+  int channels;
+  int count;
+  int *voices;             // the recorded voices, in voice order
+  float *ring;
+  uint64_t mask;           // ring samples - 1
+  uint64_t head;           // samples in, written by the callback
+  uint64_t tail;           // samples out, written by the writer
+  uint64_t frames;
+  uint64_t limit;          // frames the recording stops taking at, 0 for none
+  uint64_t dropped;        // frames that found the ring full
+  uint64_t bytes;          // of sample data in the file
+  int failed;
+  unsigned char *header;
+  int header_size;
+  rec_format_t format;     // where the sizes patched at the end are
+} rec = {};
+
+static pthread_mutex_t rec_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+  unsigned char *p;
+  int len;
+  int cap;
+  int failed;
+} rec_buf_t;
+
+static void put16(unsigned char *p, uint32_t v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+}
+
+static void put32(unsigned char *p, uint32_t v) {
+  put16(p, v & 0xffff);
+  put16(p + 2, v >> 16);
+}
+
+static void put64(unsigned char *p, uint64_t v) {
+  put32(p, (uint32_t)v);
+  put32(p + 4, (uint32_t)(v >> 32));
+}
+
+// room for n more bytes, zeroed, NULL if out of memory
+static unsigned char *buf_grow(rec_buf_t *b, int n) {
+  if (b->failed) return NULL;
+  if (b->len + n > b->cap) {
+    int cap = b->cap ? b->cap : 4096;
+    while (cap < b->len + n) cap *= 2;
+    unsigned char *p = (unsigned char *)realloc(b->p, cap);
+    if (p == NULL) {
+      b->failed = 1;
+      return NULL;
+    }
+    b->p = p;
+    b->cap = cap;
+  }
+  unsigned char *p = b->p + b->len;
+  memset(p, 0, n);
+  b->len += n;
+  return p;
+}
+
+static void buf_bytes(rec_buf_t *b, const void *data, int n) {
+  unsigned char *p = buf_grow(b, n);
+  if (p) memcpy(p, data, n);
+}
+
+static void buf_u16(rec_buf_t *b, uint32_t v) {
+  unsigned char *p = buf_grow(b, 2);
+  if (p) put16(p, v);
+}
+
+static void buf_u32(rec_buf_t *b, uint32_t v) {
+  unsigned char *p = buf_grow(b, 4);
+  if (p) put32(p, v);
+}
+
+// a string in a fixed size field, cut short if it has to be
+static void buf_text(rec_buf_t *b, const char *s, int size) {
+  unsigned char *p = buf_grow(b, size);
+  if (p) memcpy(p, s, strnlen(s, size));
+}
+
+// starts a chunk, returns where its size goes for buf_end()
+static int buf_chunk(rec_buf_t *b, const char *id) {
+  buf_bytes(b, id, 4);
+  buf_u32(b, 0);
+  return b->len - 4;
+}
+
+static void buf_end(rec_buf_t *b, int at) {
+  if (b->failed) return;
+  put32(b->p + at, b->len - at - 4);
+  if (b->len & 1) buf_grow(b, 1);
+}
+
+// a labl or note sub-chunk of LIST adtl
+static void buf_adtl(rec_buf_t *b, const char *id, int cue, const char *text) {
+  int at = buf_chunk(b, id);
+  buf_u32(b, cue);
+  buf_bytes(b, text, (int)strlen(text) + 1);
+  buf_end(b, at);
+}
+
+static int rec_header_build(rec_buf_t *b, rec_format_t *f) {
+  const int align = f->channels * f->bits / 8;
+  char text[1024];
+
+  buf_bytes(b, "RIFF", 4);
+  buf_u32(b, 0);
+  buf_bytes(b, "WAVE", 4);
+  int at = buf_chunk(b, "JUNK");
+  buf_grow(b, 28); // ds64: riff size, data size, sample count, table length
+  buf_end(b, at);
+
+  // WAVE_FORMAT_EXTENSIBLE, as anything over two channels or 16 bits should
+  // be, with no speaker positions since the channels are voices
+  static const unsigned char guid[14] = {
+    0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71
+  };
+  at = buf_chunk(b, "fmt ");
+  buf_u16(b, 0xfffe);
+  buf_u16(b, f->channels);
+  buf_u32(b, MAIN_SAMPLE_RATE);
+  buf_u32(b, MAIN_SAMPLE_RATE * align);
+  buf_u16(b, align);
+  buf_u16(b, f->bits);
+  buf_u16(b, 22);
+  buf_u16(b, f->bits);
+  buf_u32(b, 0); // channel mask
+  buf_u16(b, (f->bits == REC_FLOAT) ? 3 : 1); // sub format, float or pcm
+  buf_bytes(b, guid, sizeof(guid));
+  buf_end(b, at);
+
+  at = buf_chunk(b, "fact");
+  buf_u32(b, 0);
+  buf_end(b, at);
+  f->fact_at = at + 4;
+
+  const float bpm = tempo_bpm * 4.0f;
+  struct tm tm;
+#ifdef _WIN32
+  localtime_s(&tm, &f->when);
+#else
+  localtime_r(&f->when, &tm);
+#endif
+  at = buf_chunk(b, "bext");
+  if (f->count) {
+    snprintf(text, sizeof(text), "skred, %d voices, %g bpm", f->count, bpm);
+  } else {
+    snprintf(text, sizeof(text), "skred, master, %g bpm", bpm);
+  }
+  buf_text(b, text, 256); // description
+  buf_text(b, "skred", 32); // originator
+  buf_text(b, "", 32);      // originator reference
+  strftime(text, sizeof(text), "%Y-%m-%d", &tm);
+  buf_text(b, text, 10);
+  strftime(text, sizeof(text), "%H:%M:%S", &tm);
+  buf_text(b, text, 8);
+  unsigned char *p = buf_grow(b, 8);
+  if (p) put64(p, f->clock);
+  buf_u16(b, 1); // version
+  buf_grow(b, 64 + 10 + 180); // umid, loudness, reserved
+  snprintf(text, sizeof(text), "A=%s,F=%d,W=%d,T=skred\r\n",
+    (f->bits == REC_FLOAT) ? "PCM_FLOAT" : "PCM", MAIN_SAMPLE_RATE, f->bits);
+  buf_bytes(b, text, (int)strlen(text));
+  buf_end(b, at);
+
+  at = buf_chunk(b, "acid");
+  buf_u32(b, 0);  // flags
+  buf_u16(b, 60); // root note
+  buf_u16(b, 0);
+  buf_u32(b, 0);
+  buf_u32(b, 0);  // beats
+  buf_u16(b, 4);  // meter
+  buf_u16(b, 4);
+  uint32_t tempo;
+  memcpy(&tempo, &bpm, 4);
+  buf_u32(b, tempo);
+  buf_end(b, at);
+
+  at = buf_chunk(b, "cue ");
+  buf_u32(b, f->channels);
+  for (int c = 0; c < f->channels; c++) {
+    buf_u32(b, c + 1); // id
+    buf_u32(b, 0);     // position
+    buf_bytes(b, "data", 4);
+    buf_grow(b, 12);   // chunk start, block start, sample offset
+  }
+  buf_end(b, at);
+
+  at = buf_chunk(b, "LIST");
+  buf_bytes(b, "adtl", 4);
+  if (f->count == 0) {
+    buf_adtl(b, "labl", 1, "left");
+    buf_adtl(b, "labl", 2, "right");
+  }
+  for (int k = 0; k < f->count; k++) {
+    const int n = f->voices[k];
+    snprintf(text, sizeof(text), "v%d left", n);
+    buf_adtl(b, "labl", 2 * k + 1, text);
+    snprintf(text, sizeof(text), "v%d right", n);
+    buf_adtl(b, "labl", 2 * k + 2, text);
+    voice_format(n, text, 0);
+    buf_adtl(b, "note", 2 * k + 1, text);
+  }
+  buf_end(b, at);
+
+  at = buf_chunk(b, "data");
+  f->data_at = at;
+  return !b->failed;
+}
+
+// the sizes, as RF64 once the file is past what 32 bits hold
+static void rec_header_finish(unsigned char *h, int size, const rec_format_t *f,
+  uint64_t bytes, uint64_t frames) {
+  const uint64_t riff = (uint64_t)size - 8 + bytes;
+  if (riff > 0xffffffffULL) {
+    memcpy(h, "RF64", 4);
+    put32(h + 4, 0xffffffffU);
+    memcpy(h + REC_DS64, "ds64", 4);
+    put64(h + REC_DS64 + 8, riff);
+    put64(h + REC_DS64 + 16, bytes);
+    put64(h + REC_DS64 + 24, frames);
+    put32(h + f->fact_at, 0xffffffffU);
+    put32(h + f->data_at, 0xffffffffU);
+  } else {
+    put32(h + 4, (uint32_t)riff);
+    put32(h + f->fact_at, (uint32_t)frames);
+    put32(h + f->data_at, (uint32_t)bytes);
+  }
+}
+
+static inline void rec_s24(unsigned char *out, float g) {
+  g = (g > 1.0f) ? 1.0f : ((g < -1.0f) ? -1.0f : g);
+  int32_t s = (int32_t)lrintf(g * 8388607.0f);
+  out[0] = s & 0xff;
+  out[1] = (s >> 8) & 0xff;
+  out[2] = (s >> 16) & 0xff;
+}
+
+// samples from the ring to the file format
+static size_t rec_convert(unsigned char *out, uint64_t from, int samples) {
+  if (rec.bits == REC_FLOAT) {
+    for (int i = 0; i < samples; i++) {
+      memcpy(out + 4 * i, &rec.ring[(from + i) & rec.mask], 4);
+    }
+    return (size_t)samples * 4;
+  }
+  for (int i = 0; i < samples; i++) rec_s24(out + 3 * i, rec.ring[(from + i) & rec.mask]);
+  return (size_t)samples * 3;
+}
+
+static void *rec_main(void *arg) {
+  util_set_thread_name("rec");
+  unsigned char *out = (unsigned char *)malloc(REC_CHUNK * 4);
+  for (;;) {
+    const uint32_t wake = __atomic_load_n(&rec.wake, __ATOMIC_ACQUIRE);
+    const int last = !__atomic_load_n(&rec.running, __ATOMIC_ACQUIRE);
+    const uint64_t head = __atomic_load_n(&rec.head, __ATOMIC_ACQUIRE);
+    uint64_t tail = rec.tail;
+    if (head == tail) {
+      if (last) break;
+      futex_wait_timeout(&rec.wake, wake, REC_WAIT_MS);
+      continue;
+    }
+    while (tail < head) {
+      const int samples = (head - tail < REC_CHUNK) ? (int)(head - tail) : REC_CHUNK;
+      if (out && !rec.failed) {
+        size_t bytes = rec_convert(out, tail, samples);
+        if (fwrite(out, bytes, 1, rec.file) != 1) {
+          printf("# recording write failed, the rest is dropped\n");
+          rec.failed = 1;
+        } else {
+          rec.bytes += bytes;
+        }
+      }
+      tail += samples;
+      __atomic_store_n(&rec.tail, tail, __ATOMIC_RELEASE);
+    }
+  }
+  free(out);
+  return NULL;
+}
+
+int rec_start(const char *name, int bits, double seconds) {
+  pthread_mutex_lock(&rec_lock);
+  if (rec.file) {
+    pthread_mutex_unlock(&rec_lock);
+    printf("# already recording\n");
+    return -1;
+  }
+  int count = 0;
+  for (int n = 0; n < voice_max; n++) if (voice_record[n]) count++;
+  if (count == 0) {
+    pthread_mutex_unlock(&rec_lock);
+    return 0;
+  }
+  rec.bits = (bits == REC_PCM24) ? REC_PCM24 : REC_FLOAT;
+  rec.count = count;
+  rec.channels = count * AUDIO_CHANNELS;
+  rec.voices = (int *)malloc(count * sizeof(int));
+  uint64_t size = 1;
+  while (size < (uint64_t)rec.channels * MAIN_SAMPLE_RATE * REC_RING_SEC) size <<= 1;
+  rec.ring = (float *)malloc(size * sizeof(float));
+  rec.file = fopen(name, "wb");
+  if (rec.voices == NULL || rec.ring == NULL || rec.file == NULL) {
+    printf("# can't record to %s\n", name);
+    if (rec.file) fclose(rec.file);
+    rec.file = NULL;
+    free(rec.voices);
+    free(rec.ring);
+    rec.voices = NULL;
+    rec.ring = NULL;
+    pthread_mutex_unlock(&rec_lock);
+    return -1;
+  }
+  setvbuf(rec.file, NULL, _IOFBF, 1 << 20);
+  count = 0;
+  for (int n = 0; n < voice_max; n++) if (voice_record[n]) rec.voices[count++] = n;
+  rec_buf_t header = {};
+  rec.format = (rec_format_t){
+    .bits = rec.bits, .channels = rec.channels, .count = rec.count, .voices = rec.voices,
+    .clock = synth_sample_count, .when = time(NULL),
+  };
+  if (!rec_header_build(&header, &rec.format)) {
+    printf("# no memory for the recording header\n");
+    free(header.p);
+    fclose(rec.file);
+    rec.file = NULL;
+    free(rec.voices);
+    free(rec.ring);
+    rec.voices = NULL;
+    rec.ring = NULL;
+    pthread_mutex_unlock(&rec_lock);
+    return -1;
+  }
+  rec.header = header.p;
+  rec.header_size = header.len;
+  fwrite(rec.header, rec.header_size, 1, rec.file);
+  rec.mask = size - 1;
+  rec.head = rec.tail = 0;
+  rec.frames = rec.dropped = rec.bytes = 0;
+  rec.limit = (seconds > 0.0) ? (uint64_t)(seconds * MAIN_SAMPLE_RATE + 0.5) : 0;
+  rec.failed = 0;
+  rec.running = 1;
+  if (pthread_create(&rec.thread, NULL, rec_main, NULL) != 0) {
+    printf("# can't start the recording thread\n");
+    fclose(rec.file);
+    rec.file = NULL;
+    free(rec.header);
+    rec.header = NULL;
+    free(rec.voices);
+    free(rec.ring);
+    rec.voices = NULL;
+    rec.ring = NULL;
+    pthread_mutex_unlock(&rec_lock);
+    return -1;
+  }
+  __atomic_store_n(&rec.state, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&rec_lock);
+  return rec.channels;
+}
+
+long rec_stop(void) {
+  pthread_mutex_lock(&rec_lock);
+  if (rec.file == NULL) {
+    pthread_mutex_unlock(&rec_lock);
+    return -1;
+  }
+  // the callback is done with the ring once a rec_block() that started
+  // after this has finished, which is one that counted itself in and saw
+  // the state off. One from before that may still be filling the ring
+  // however seen looked, so it has to move on. Give up waiting if the
+  // device has stopped calling. Offline, the last call has long returned.
+  __atomic_store_n(&rec.state, 0, __ATOMIC_RELEASE);
+  const uint32_t before = __atomic_load_n(&rec.seen, __ATOMIC_ACQUIRE);
+  for (int t = 0; t < 1000 && !rec.offline; t++) {
+    const uint32_t seen = __atomic_load_n(&rec.seen, __ATOMIC_ACQUIRE);
+    if (seen != before && !(seen & 1)) break;
+    futex_wait_timeout(&rec.seen, seen, 1);
+  }
+  __atomic_store_n(&rec.running, 0, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&rec.wake, 1, __ATOMIC_RELEASE);
+  futex_wake(&rec.wake, 1);
+  pthread_join(rec.thread, NULL);
+
+  rec_header_finish(rec.header, rec.header_size, &rec.format, rec.bytes, rec.frames);
+  if (fseek(rec.file, 0, SEEK_SET) == 0) fwrite(rec.header, rec.header_size, 1, rec.file);
+  fclose(rec.file);
+  free(rec.header);
+  rec.header = NULL;
+  rec.file = NULL;
+  if (rec.dropped) printf("# recording dropped %llu frames\n", (unsigned long long)rec.dropped);
+  free(rec.voices);
+  free(rec.ring);
+  rec.voices = NULL;
+  rec.ring = NULL;
+  long frames = (long)rec.frames;
+  pthread_mutex_unlock(&rec_lock);
+  return frames;
+}
+
+void rec_block(int frames) {
+  const uint32_t state = __atomic_load_n(&rec.state, __ATOMIC_ACQUIRE);
+  if (state && rec.limit && rec.frames + (uint64_t)frames > rec.limit) {
+    // a limited recording takes what is left of it and then nothing
+    frames = (int)(rec.limit - rec.frames);
+  }
+  if (state && frames > 0) {
+    const int channels = rec.channels;
+    const uint64_t need = (uint64_t)frames * channels;
+    const uint64_t head = rec.head;
+    const uint64_t tail = __atomic_load_n(&rec.tail, __ATOMIC_ACQUIRE);
+    if (frames > synth_stem_frames || head - tail + need > rec.mask + 1) {
+      __atomic_add_fetch(&rec.dropped, frames, __ATOMIC_RELAXED);
+    } else {
+      for (int k = 0; k < rec.count; k++) {
+        const int n = rec.voices[k];
+        // a voice reset while recording has no stem any more
+        const float *left = voice_record[n] ? synth_stem(n, 0) : NULL;
+        const float *right = voice_record[n] ? synth_stem(n, 1) : NULL;
+        uint64_t at = head + (uint64_t)k * AUDIO_CHANNELS;
+        for (int i = 0; i < frames; i++) {
+          rec.ring[at & rec.mask] = left ? left[i] : 0.0f;
+          rec.ring[(at + 1) & rec.mask] = right ? right[i] : 0.0f;
+          at += channels;
+        }
+      }
+      __atomic_store_n(&rec.head, head + need, __ATOMIC_RELEASE);
+      __atomic_add_fetch(&rec.frames, frames, __ATOMIC_RELAXED);
+    }
+  }
+  const uint32_t calls = (__atomic_load_n(&rec.seen, __ATOMIC_RELAXED) >> 1) + 1;
+  __atomic_store_n(&rec.seen, (calls << 1) | (state ? 1 : 0), __ATOMIC_RELEASE);
+}
+
+void rec_wait(int frames) {
+  if (!__atomic_load_n(&rec.state, __ATOMIC_ACQUIRE)) return;
+  const uint64_t need = (uint64_t)frames * rec.channels;
+  if (need > rec.mask + 1) return; // rec_block() drops it whatever happens
+  for (;;) {
+    const uint32_t wake = __atomic_add_fetch(&rec.wake, 1, __ATOMIC_RELEASE);
+    if (rec.head - __atomic_load_n(&rec.tail, __ATOMIC_ACQUIRE) + need <= rec.mask + 1) break;
+    futex_wake(&rec.wake, 1);
+    futex_wait_timeout(&rec.wake, wake, 1);
+  }
+}
+
+void rec_offline(int on) {
+  rec.offline = on;
+}
+
+int rec_active(void) {
+  return __atomic_load_n(&rec.state, __ATOMIC_ACQUIRE) != 0;
+}
+
+uint64_t rec_frames(void) {
+  return __atomic_load_n(&rec.frames, __ATOMIC_RELAXED);
+}
+
+uint64_t rec_dropped(void) {
+  return __atomic_load_n(&rec.dropped, __ATOMIC_RELAXED);
+}
+
+// The capture keeps the master mix of the last few minutes whether or not
+// anything is recording, so a take that only turned out to be good can
+// still be saved afterwards. The callback converts each period to 16 bit
+// stereo into a ring of whole frames (about 5ns a frame, a fifth of a
+// millisecond of work a second), and rec_capture_save() copies out what it
+// wants and checks the callback hasn't lapped it while it did.
+
+#define REC_CAPTURE_SLACK (8192) // frames a callback might be writing past head
+
+static struct {
+  int16_t *ring;           // interleaved left, right
+  uint64_t size;           // frames
+  uint64_t head;           // frames in, written by the callback
+  uint64_t start;          // synth_sample_count at frame 0
+} cap = {};
+
+int rec_capture_init(int seconds) {
+  if (seconds <= 0) return 0;
+  cap.size = (uint64_t)seconds * MAIN_SAMPLE_RATE;
+  // touched now so the callback doesn't page fault its way through it
+  cap.ring = (int16_t *)malloc(cap.size * 2 * sizeof(int16_t));
+  if (cap.ring == NULL) {
+    printf("# no memory for %d seconds of capture\n", seconds);
+    cap.size = 0;
+    return -1;
+  }
+  memset(cap.ring, 0, cap.size * 2 * sizeof(int16_t));
+  cap.head = 0;
+  return 0;
+}
+
+void rec_capture_free(void) {
+  free(cap.ring);
+  cap.ring = NULL;
+  cap.size = 0;
+}
+
+// rounded without lrintf(), which is a library call unless errno is off
+static inline int16_t rec_s16(float g) {
+  g = (g > 1.0f) ? 1.0f : ((g < -1.0f) ? -1.0f : g);
+  return (int16_t)(g * 32767.0f + ((g < 0.0f) ? -0.5f : 0.5f));
+}
+
+static void rec_capture_copy(int16_t *out, const float *in, int frames, int channels) {
+  if (channels == 2) {
+    for (int i = 0; i < 2 * frames; i++) out[i] = rec_s16(in[i]);
+    return;
+  }
+  const int right = (channels > 1) ? 1 : 0;
+  for (int i = 0; i < frames; i++) {
+    out[2 * i + 0] = rec_s16(in[i * channels]);
+    out[2 * i + 1] = rec_s16(in[i * channels + right]);
+  }
+}
+
+void rec_capture_block(const float *buffer, int frames, int channels) {
+  if (cap.ring == NULL || frames <= 0) return;
+  const uint64_t head = cap.head;
+  if (head == 0) cap.start = synth_sample_count - frames;
+  const uint64_t at = head % cap.size;
+  const int first = (at + frames <= cap.size) ? frames : (int)(cap.size - at);
+  rec_capture_copy(cap.ring + 2 * at, buffer, first, channels);
+  rec_capture_copy(cap.ring, buffer + first * channels, frames - first, channels);
+  __atomic_store_n(&cap.head, head + frames, __ATOMIC_RELEASE);
+}
+
+double rec_capture_seconds(void) {
+  const uint64_t head = __atomic_load_n(&cap.head, __ATOMIC_ACQUIRE);
+  return (double)((head < cap.size) ? head : cap.size) / MAIN_SAMPLE_RATE;
+}
+
+long rec_capture_save(const char *name, float seconds) {
+  if (cap.ring == NULL) return -1;
+  const uint64_t head = __atomic_load_n(&cap.head, __ATOMIC_ACQUIRE);
+  const uint64_t held = (head + REC_CAPTURE_SLACK < cap.size) ? head : cap.size - REC_CAPTURE_SLACK;
+  uint64_t frames = (seconds > 0) ? (uint64_t)(seconds * MAIN_SAMPLE_RATE) : held;
+  if (frames > held) frames = held;
+  if (frames == 0) return 0;
+  uint64_t from = head - frames;
+  int16_t *copy = (int16_t *)malloc(frames * 2 * sizeof(int16_t));
+  if (copy == NULL) {
+    printf("# no memory to save the capture\n");
+    return -1;
+  }
+  const uint64_t at = from % cap.size;
+  const uint64_t first = (at + frames <= cap.size) ? frames : cap.size - at;
+  memcpy(copy, cap.ring + 2 * at, first * 2 * sizeof(int16_t));
+  memcpy(copy + 2 * first, cap.ring, (frames - first) * 2 * sizeof(int16_t));
+  // anything the callback got to while that was copied is lost
+  const uint64_t now = __atomic_load_n(&cap.head, __ATOMIC_ACQUIRE);
+  const uint64_t oldest = now + REC_CAPTURE_SLACK - cap.size;
+  uint64_t skip = 0;
+  if (now + REC_CAPTURE_SLACK > cap.size && from < oldest) {
+    skip = (oldest - from < frames) ? oldest - from : frames;
+    from += skip;
+    frames -= skip;
+  }
+
+  rec_buf_t header = {};
+  rec_format_t format = {
+    .bits = REC_PCM16, .channels = 2, .count = 0, .voices = NULL,
+    .clock = cap.start + from,
+    .when = time(NULL) - (time_t)((now - from) / MAIN_SAMPLE_RATE),
+  };
+  const uint64_t bytes = frames * 2 * sizeof(int16_t);
+  FILE *file = fopen(name, "wb");
+  int ok = file && rec_header_build(&header, &format);
+  if (ok) {
+    rec_header_finish(header.p, header.len, &format, bytes, frames);
+    ok = fwrite(header.p, header.len, 1, file) == 1;
+    if (ok && frames) ok = fwrite(copy + 2 * skip, bytes, 1, file) == 1;
+  }
+  if (file && fclose(file) != 0) ok = 0;
+  free(header.p);
+  free(copy);
+  if (!ok) {
+    printf("# can't save the capture to %s\n", name);
+    return -1;
+  }
+  return (long)frames;
+}
+
+// The offline render's mix has no callback to keep on time, so it is
+// converted and written by the render loop itself, a period at a time.
+
+static struct {
+  FILE *file;
+  unsigned char *header;
+  int header_size;
+  unsigned char *out;
+  int out_frames;
+  int failed;
+  uint64_t frames;
+  uint64_t bytes;
+  rec_format_t format;
+} mix = {};
+
+int rec_mix_open(const char *name, int bits, time_t when) {
+  if (mix.file) return -1;
+  rec_buf_t header = {};
+  mix.format = (rec_format_t){
+    .bits = (bits == REC_PCM24) ? REC_PCM24 : REC_FLOAT, .channels = 2, .count = 0, .voices = NULL,
+    .clock = synth_sample_count, .when = when,
+  };
+  mix.file = fopen(name, "wb");
+  if (mix.file == NULL || !rec_header_build(&header, &mix.format)) {
+    printf("# can't write the mix to %s\n", name);
+    if (mix.file) fclose(mix.file);
+    mix.file = NULL;
+    free(header.p);
+    return -1;
+  }
+  setvbuf(mix.file, NULL, _IOFBF, 1 << 20);
+  mix.header = header.p;
+  mix.header_size = header.len;
+  mix.failed = fwrite(mix.header, mix.header_size, 1, mix.file) != 1;
+  mix.frames = mix.bytes = 0;
+  return 0;
+}
+
+int rec_mix_block(const float *buffer, int frames, int channels) {
+  if (mix.file == NULL || mix.failed) return -1;
+  const int size = mix.format.bits / 8;
+  if (frames > mix.out_frames) {
+    unsigned char *out = (unsigned char *)realloc(mix.out, (size_t)frames * 2 * size);
+    if (out == NULL) {
+      mix.failed = 1;
+      return -1;
+    }
+    mix.out = out;
+    mix.out_frames = frames;
+  }
+  const int right = (channels > 1) ? 1 : 0;
+  for (int i = 0; i < frames; i++) {
+    const float *in = buffer + i * channels;
+    if (size == 4) {
+      memcpy(mix.out + 8 * i, in, 4);
+      memcpy(mix.out + 8 * i + 4, in + right, 4);
+    } else {
+      rec_s24(mix.out + 6 * i, in[0]);
+      rec_s24(mix.out + 6 * i + 3, in[right]);
+    }
+  }
+  const size_t bytes = (size_t)frames * 2 * size;
+  if (fwrite(mix.out, bytes, 1, mix.file) != 1) {
+    printf("# mix write failed\n");
+    mix.failed = 1;
+    return -1;
+  }
+  mix.bytes += bytes;
+  mix.frames += frames;
+  return 0;
+}
+
+long rec_mix_close(void) {
+  if (mix.file == NULL) return -1;
+  rec_header_finish(mix.header, mix.header_size, &mix.format, mix.bytes, mix.frames);
+  int ok = !mix.failed;
+  if (ok && fseek(mix.file, 0, SEEK_SET) == 0) ok = fwrite(mix.header, mix.header_size, 1, mix.file) == 1;
+  if (fclose(mix.file) != 0) ok = 0;
+  mix.file = NULL;
+  free(mix.header);
+  free(mix.out);
+  mix.header = NULL;
+  mix.out = NULL;
+  mix.out_frames = 0;
+  return ok ? (long)mix.frames : -1;
+}
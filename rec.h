@@ -0,0 +1,48 @@
+#ifndef _REC_H_
+#define _REC_H_
+
+#include <stdint.h>
+#include <time.h>
+
+// Streaming multitrack recorder. rec_start() opens a Broadcast WAVE (RF64
+// past 4GB) with a left and right channel for every voice with
+// voice_record[] set, labelled with the voice and its settings. The audio
+// callback hands each period's stems over with rec_block(), and a writer
+// thread streams them to disk until rec_stop() finishes the file.
+//
+// Separately, the capture always holds the last rec_capture_init() seconds
+// of the master mix as 16 bit stereo, and rec_capture_save() writes the
+// end of it out as a wave file.
+//
+// With no device at all, the offline render writes its mix with
+// rec_mix_block() and calls rec_wait() ahead of rec_block(), so its stems
+// wait for the writer instead of being dropped. It says so with
+// rec_offline(), as then rec_block() is only ever called from the thread
+// that stops the recording and rec_stop() has no callback to wait for.
+
+#define REC_FLOAT (32) // bits, IEEE float
+#define REC_PCM24 (24)
+#define REC_PCM16 (16)
+#define REC_RING_SEC (2) // audio the writer can fall behind by
+#define REC_CAPTURE_SEC (300)
+
+int rec_start(const char *name, int bits, double seconds); // channels, 0 if no voice is marked, 0 seconds for no limit
+long rec_stop(void);                      // frames written, -1 if not recording
+void rec_block(int frames);               // audio thread, after synth()
+void rec_wait(int frames);                // until rec_block() has room, for a thread that can wait
+void rec_offline(int on);                 // rec_block() runs on the thread that calls rec_stop()
+int rec_active(void);
+uint64_t rec_frames(void);
+uint64_t rec_dropped(void);
+
+int rec_capture_init(int seconds);         // 0 seconds for none
+void rec_capture_free(void);
+void rec_capture_block(const float *buffer, int frames, int channels); // audio thread, after synth()
+long rec_capture_save(const char *name, float seconds); // the last seconds, 0 for all of it, frames written
+double rec_capture_seconds(void);          // held so far
+
+int rec_mix_open(const char *name, int bits, time_t when); // when is the bext time, -1 on error
+int rec_mix_block(const float *buffer, int frames, int channels); // -1 once a write has failed
+long rec_mix_close(void);                 // frames written, -1 on error
+
+#endif
@@ -2,6 +2,7 @@
 #define _SCOPE_SHARED_H_
 
 #include "skred.h"
+#include "synth-types.h"
 
 #define SCOPE_WIDTH_IN_SAMPLES (44100 * 2)
 #define SCOPE_WIDTH_IN_PIXELS (800)
@@ -24,6 +25,9 @@ typedef struct {
   char voice_text[1024];
   char status_text[1024];
   char debug_text[1024];
+  synth_timing_t timing; // as of the last callback
+  int voice_count;
+  float voice_cost[VOICE_LIMIT]; // ns a frame, see voice_cost[]
 } scope_buffer_t;
 
 #endif
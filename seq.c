@@ -3,6 +3,7 @@
 #include "synth-types.h"
 #include "synth.h"
 #include "seq.h"
+#include "timeline.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -170,10 +171,12 @@ void seq(int frame_count) {
   static wire_t v = WIRE();
   for (int q = 0; q < QUEUE_SIZE; q++) {
     if ((work_queue[q].state == Q_READY) && (work_queue[q].when <= (synth_sample_count + frame_count))) {
+      const uint64_t t = timeline_start();
       work_queue[q].state = Q_USING;
       v.voice = work_queue[q].voice;
       wire(work_queue[q].what, &v);
       work_queue[q].state = Q_FREE;
+      timeline_span(TIMELINE_QUEUE, t, q);
     }
   }
 
@@ -201,7 +204,11 @@ void seq(int frame_count) {
         }
       }
       seq_counter[p]++;
-      if (seq_pattern_mute[p][seq_pointer[p]] == 0) wire(seq_pattern[p][seq_pointer[p]], &w);
+      if (seq_pattern_mute[p][seq_pointer[p]] == 0) {
+        const uint64_t t = timeline_start();
+        wire(seq_pattern[p][seq_pointer[p]], &w);
+        timeline_span(TIMELINE_STEP, t, p);
+      }
       seq_pointer[p]++;
       switch (seq_pattern[p][seq_pointer[p]][0]) {
         case '\0':
@@ -43,6 +43,10 @@ scope_buffer_t *scope = &scope_safety;
 
 #include "synth-types.h"
 #include "synth.h"
+#include "synth-pool.h"
+#include "synth-perf.h"
+#include "timeline.h"
+#include "rec.h"
 
 float tempo_time_per_step = 60.0f;
 float tempo_bpm = 120.0f / 4.0f;
@@ -81,54 +85,46 @@ void seq_callback(ma_device* pDevice, void* output, const void* input, ma_uint32
 }
 #endif
 
-int rec_state = 0;
-long rec_ptr = 0;
-float rec_sec = (float)REC_IN_SEC;
-long rec_max = REC_IN_SEC * MAIN_SAMPLE_RATE * AUDIO_CHANNELS * VOICE_MAX;
-float one_skred_frame[ONE_FRAME_MAX * AUDIO_CHANNELS * VOICE_MAX];
-//float recording[REC_IN_SEC * MAIN_SAMPLE_RATE * AUDIO_CHANNELS * VOICE_MAX];
-float *recording = NULL;
-
-void synth_callback_init(float max_sec) {
-  if (recording) free(recording);
-  recording = NULL;
-  rec_sec = max_sec;
-  float max_samples = max_sec * (float)(MAIN_SAMPLE_RATE * AUDIO_CHANNELS * VOICE_MAX);
-  rec_max = max_samples;
-  recording = (float *)malloc(rec_max * sizeof(float));
+static int capture_seconds = REC_CAPTURE_SEC;
+static int synth_timeline = -1; // reserved here, taken by the callback
+
+void synth_callback_init(void) {
+  synth_timeline = timeline_reserve("synth");
+  // a device may hand us a longer period than it was asked for
+  int stem_frames = requested_synth_frames_per_callback;
+  if (stem_frames < SYNTH_STEM_FRAMES) stem_frames = SYNTH_STEM_FRAMES;
+  synth_stem_init(stem_frames);
+  rec_capture_init(capture_seconds);
 }
 
 void synth_callback_free(void) {
-  if (recording) free(recording);
-  recording = NULL;
-  rec_max = 0;
+  rec_stop();
+  rec_capture_free();
 }
 
-void synth_callback(ma_device* pDevice, void* output, const void* input, ma_uint32 frame_count) {
+// a period's work, from the device's callback or the offline render's loop
+void synth_period(float *output, float *input, int frame_count, int num_channels, void *user) {
   static int first = 1;
-  static int num_channels = 1;
   if (first) {
     util_set_thread_name("synth");
+    timeline_thread(synth_timeline);
     if (scope_enable) scope->buffer_pointer = 0;
-    num_channels = (int)pDevice->playback.channels;
     first = 0;
   }
-  synth((float *)output, (float *)input, (int)frame_count, (int)pDevice->playback.channels, pDevice->pUserData);
-  sprintf(scope->debug_text, "%d %d %ld", frame_count, rec_state, rec_ptr);
-  // copy frame buffer to shared memory?
-  seq((int)frame_count);
-  if (rec_state) {
-    float *f = one_skred_frame;
-    for (int i = 0; i < frame_count * num_channels * VOICE_MAX; i+=2) {
-      if (rec_ptr < rec_max) {
-        recording[rec_ptr++] = f[i];   // left
-        recording[rec_ptr++] = f[i+1]; // right
-      } else {
-        rec_state = 0;
-        break;
-      }
-    }
+  const uint64_t t = timeline_start();
+  synth(output, input, frame_count, num_channels, user);
+  rec_block(frame_count);
+  rec_capture_block(output, frame_count, num_channels);
+  sprintf(scope->debug_text, "%d %d %llu", frame_count, rec_active(), (unsigned long long)rec_frames());
+  synth_timing_get(&scope->timing);
+  static uint64_t cost_seen = 0;
+  if (synth_cost_samples != cost_seen) {
+    cost_seen = synth_cost_samples;
+    scope->voice_count = voice_max;
+    memcpy(scope->voice_cost, voice_cost, voice_max * sizeof(float));
   }
+  // copy frame buffer to shared memory?
+  seq(frame_count);
   if (scope_enable) {
     float *f = (float *)output;
     for (int i = 0; i < frame_count * num_channels; i+=2) {
@@ -148,7 +144,76 @@ void synth_callback(ma_device* pDevice, void* output, const void* input, ma_uint
   volatile uint32_t *futex_word = (volatile uint32_t *)&scope->frame_count;
   __atomic_add_fetch(futex_word, frame_count, __ATOMIC_SEQ_CST);
 #endif
-  //
+  timeline_span(TIMELINE_CALLBACK, t, frame_count);
+}
+
+void synth_callback(ma_device* pDevice, void* output, const void* input, ma_uint32 frame_count) {
+  synth_period((float *)output, (float *)input, (int)frame_count, (int)pDevice->playback.channels, pDevice->pUserData);
+}
+
+// -r renders without opening a device, as fast as the cpu goes: the
+// callback's work a period at a time, with the mix written to the file and
+// the stems of any voices marked for recording (r1) beside it.
+
+#define RENDER_SECONDS (10.0)
+
+static char render_name[1024] = "";
+static double render_seconds = RENDER_SECONDS;
+
+static int render(int load_patch_number, char *execute_from_start) {
+  wire_t w = WIRE();
+  w.output = 1;
+  w.debug = debug;
+  w.trace = trace;
+
+  if (load_patch_number >= 0) sk_load(NULL, 0, load_patch_number, 0);
+  if (execute_from_start[0] != '\0') wire(execute_from_start, &w);
+
+  // SOURCE_DATE_EPOCH pins the bext time, so the same patch renders to the same bytes
+  time_t when = time(NULL);
+  const char *epoch = getenv("SOURCE_DATE_EPOCH");
+  if (epoch) when = (time_t)strtoll(epoch, NULL, 10);
+  if (rec_mix_open(render_name, REC_FLOAT, when) != 0) return 1;
+  rec_offline(1);
+
+  char stems[1100];
+  int n = (int)strlen(render_name);
+  if (n >= 4 && strcasecmp(render_name + n - 4, ".wav") == 0) n -= 4;
+  snprintf(stems, sizeof(stems), "%.*s-stems.wav", n, render_name);
+  if (!rec_active() && rec_start(stems, REC_FLOAT, 0) > 0) printf("# stems to %s\n", stems);
+
+  const int period = requested_synth_frames_per_callback;
+  float *buffer = (float *)calloc((size_t)period * AUDIO_CHANNELS, sizeof(float));
+  if (buffer == NULL) {
+    rec_mix_close();
+    return 1;
+  }
+  const uint64_t total = (uint64_t)(render_seconds * MAIN_SAMPLE_RATE);
+  const uint64_t t = timeline_now();
+  int failed = 0;
+  for (uint64_t done = 0; done < total; ) {
+    const int frames = (total - done < (uint64_t)period) ? (int)(total - done) : period;
+    rec_wait(frames);
+    synth_period(buffer, NULL, frames, AUDIO_CHANNELS, NULL);
+    if (rec_mix_block(buffer, frames, AUDIO_CHANNELS) != 0) {
+      failed = 1;
+      break;
+    }
+    done += frames;
+  }
+  const double took = (double)(timeline_now() - t) / 1e9;
+  free(buffer);
+
+  long frames = rec_mix_close();
+  if (frames < 0) failed = 1;
+  const double seconds = (double)((frames > 0) ? frames : 0) / MAIN_SAMPLE_RATE;
+  printf("# rendered %.1f seconds to %s in %.2f seconds, %.1fx realtime\n",
+    seconds, render_name, took, (took > 0) ? seconds / took : 0.0);
+  if (rec_active()) {
+    long stem_frames = rec_stop();
+    if (stem_frames >= 0) printf("# recorded %ld frames\n", stem_frames);
+  }
+  return failed;
 }
 
 void sleep_float(double seconds) {
@@ -194,6 +259,7 @@ char my_data[] = "hello";
 int main(int argc, char *argv[]) {
   int load_patch_number = -1;
   int udp_port = UDP_PORT;
+  int synth_threads = 1;
   char execute_from_start[1024] = "";
   int use_edit = 1;
   use_edit = use_edit; // avoid unused warning on win32 compile
@@ -208,6 +274,20 @@ int main(int argc, char *argv[]) {
           case 'l': load_patch_number = (int)strtol(&argv[i][2], NULL, 0); break;
           case '1': requested_synth_frames_per_callback = (int)strtol(&argv[i][2], NULL, 0); break;
           case '2': requested_seq_frames_per_callback = (int)strtol(&argv[i][2], NULL, 0); break;
+          case 'w': synth_threads = (int)strtol(&argv[i][2], NULL, 0); break;
+          case 'V': voice_max = (int)strtol(&argv[i][2], NULL, 0); break;
+          case 'k':
+            synth_control_frames = (int)strtol(&argv[i][2], NULL, 0);
+            synth_control_default = (synth_control_frames > 1);
+            break;
+          case 'c': capture_seconds = (int)strtol(&argv[i][2], NULL, 0); break;
+          case 'P': synth_perf_enable(1); break;
+          case 'r': {
+            // the file may be attached or the next argument
+            const char *name = (argv[i][2] == '\0' && i + 1 < argc) ? argv[++i] : &argv[i][2];
+            snprintf(render_name, sizeof(render_name), "%s", name);
+          } break;
+          case 's': render_seconds = strtod(&argv[i][2], NULL); break;
           case 'e': {
             printf("# %s\n", argv[i]);
             strcpy(execute_from_start, &argv[i][2]);
@@ -229,11 +309,23 @@ int main(int argc, char *argv[]) {
 
   perf_start();
 
-  synth_callback_init(REC_IN_SEC);
   synth_init();
+  if (render_name[0] != '\0') capture_seconds = 0; // nothing to capture the render for
+  synth_callback_init();
   wave_table_init();
   voice_init();
   seq_init();
+  synth_pool_start(synth_threads);
+
+  if (render_name[0] != '\0') {
+    int r = render(load_patch_number, execute_from_start);
+    perf_stop();
+    synth_pool_stop();
+    wave_free();
+    synth_free();
+    synth_callback_free();
+    return r;
+  }
 
   // miniaudio's synth device setup
   ma_device_config synth_config = ma_device_config_init(ma_device_type_playback);
@@ -245,7 +337,7 @@ int main(int argc, char *argv[]) {
   synth_config.periodSizeInMilliseconds = 0;
   synth_config.periods = 3;
   synth_config.noClip = MA_TRUE;
-  synth_config.pUserData = &one_skred_frame;
+  synth_config.pUserData = NULL;
   ma_device synth_device;
   ma_device_init(NULL, &synth_config, &synth_device);
   ma_device_start(&synth_device);
@@ -269,6 +361,7 @@ int main(int argc, char *argv[]) {
   if (audio_show(NULL) != 0) return 1;
 
   util_set_thread_name("repl");
+  timeline_thread(timeline_reserve("repl"));
 
   if (udp_port != 0) {
     int r = udp_start(udp_port);
@@ -362,6 +455,7 @@ int main(int argc, char *argv[]) {
 #endif
   sleep_float(.5); // make sure we don't crash the callback b/c thread timing and wave_data
   ma_device_uninit(&synth_device);
+  synth_pool_stop();
   sleep_float(.5); // make sure we don't crash the callback b/c thread timing and wave_data
   sleep_float(.5); // make sure we don't crash the callback b/c thread timing and wave_data
 
@@ -6,19 +6,19 @@
 #define MAIN_SAMPLE_RATE (44100)
 
 #define HISTORY_FILE ".skred_history"
-#define VOICE_MAX (64)
+#define VOICE_DEFAULT (64) // -V<n> at startup
+#define VOICE_LIMIT (4096)
 #define AUDIO_CHANNELS (2)
 #define AMY_FACTOR (0.025f)
 #define SYNTH_FRAMES_PER_CALLBACK (512)
+#define SYNTH_BLOCK_FRAMES (128)
+#define SYNTH_STEM_FRAMES (4096) // longest period the stems are sized for, at least
+#define SYNTH_CONTROL_FRAMES (32) // for voices set to k1, -k<n> at startup sets it for all
 #define SEQ_FRAMES_PER_CALLBACK (128)
 
-#define REC_IN_SEC (5 * 60)
 #define ONE_FRAME_MAX (256 * 1024)
-extern int rec_state;
-extern long rec_max;
-extern float rec_sec;
-extern long rec_ptr;
-extern float *recording;
+
+extern int voice_max; // voices allocated by synth_init()
 
 
 enum {
@@ -28,7 +28,9 @@ enum {
   WAVE_TABLE_SAW_UP,   // 3
   WAVE_TABLE_TRI,      // 4
   WAVE_TABLE_NOISE,    // 5
-  WAVE_TABLE_NOISE_ALT,// 6
+  WAVE_TABLE_NOISE_ALT,// 6 white noise, generated per voice
+  WAVE_TABLE_NOISE_PINK,  // 7
+  WAVE_TABLE_NOISE_BROWN, // 8
 
   WAVE_TABLE_KRG1 = 32,
   WAVE_TABLE_KRG2,
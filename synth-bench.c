@@ -0,0 +1,212 @@
+// synth-bench - render a patch of many voices offline and report the cost
+//
+// synth-bench [-V<voices>] [-a<active>] [-b<blocks>] [-n<frames>] [-w<threads>] [-k<frames>] [-f] [-s] [-p] [-e] [-F] [-c]
+//
+//   -V  voices allocated (voice_max), default 1024
+//   -a  voices sounding, spread evenly over -V, default 256
+//   -b  callbacks to render, default 2000
+//   -n  frames per callback, default 512
+//   -w  render threads
+//   -k  every voice at a control rate of this many frames, 1 is audio rate
+//   -f  flat arena, synth.def order instead of hot arrays first
+//   -s  scalar renderer only
+//   -p  plain wavetable voices only (no filters, envelopes or modulation)
+//   -e  every voice on a slow envelope, still in attack or decay while timed
+//   -F  every voice through a low pass filter
+//   -c  every voice phase distorted, the odd ones with their distortion
+//       modulated by the voice before
+//
+// Where perf_event_open() is allowed it also counts L1 data cache read
+// misses over the render loop, so -f against the default shows what the
+// hot/cold split buys.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "skred.h"
+#include "synth-types.h"
+#include "synth.h"
+#include "synth-simd.h"
+#include "synth-pool.h"
+
+int debug = 0;
+
+static int l1_open(void) {
+#ifdef __linux__
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_L1D |
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.inherit = 1; // count the render threads too
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+static void l1_enable(int fd, int on) {
+#ifdef __linux__
+  if (fd < 0) return;
+  if (on) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  } else {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  }
+#endif
+}
+
+static long long l1_read(int fd) {
+  long long count = -1;
+#ifdef __linux__
+  if (fd >= 0 && read(fd, &count, sizeof(count)) != sizeof(count)) count = -1;
+#endif
+  return count;
+}
+
+static void patch(int active, int plain, int slow, int filter, int cz) {
+  int step = voice_max / active;
+  if (step < 1) step = 1;
+  int last = -1;
+  for (int k = 0; k < active; k++) {
+    int n = k * step;
+    if (n >= voice_max) break;
+    wave_set(n, k % 5);
+    freq_set(n, 55.0f + 7.0f * (float)k);
+    amp_set(n, 1.0f / (float)active);
+    pan_set(n, (float)(k % 9) / 4.0f - 1.0f);
+    if (!plain) {
+      switch (k % 4) {
+        case 1:
+          voice_filter_mode[n] = 1;
+          voice_features_update(n);
+          mmf_set_params(n, 800.0f + 10.0f * (float)k, 0.9f);
+          break;
+        case 2:
+          envelope_set(n, 0.01f, 0.2f, 0.7f, 0.3f);
+          envelope_velocity(n, 1.0f);
+          break;
+        case 3:
+          if (last >= 0) amp_mod_set(n, last, 0.5f);
+          break;
+      }
+    }
+    if (slow) {
+      envelope_set(n, 2.0f, 8.0f, 0.5f, 1.0f);
+      envelope_velocity(n, 1.0f);
+    }
+    if (filter) {
+      voice_filter_mode[n] = FILTER_LOWPASS;
+      voice_features_update(n);
+      mmf_set_params(n, 200.0f + 10.0f * (float)k, 0.7f);
+    }
+    if (cz) {
+      cz_set(n, 1 + k % 7, 0.5f);
+      if ((k & 1) && last >= 0) cmod_set(n, last, 0.3f);
+    }
+    last = n;
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+  int active = 256;
+  int blocks = 2000;
+  int frames = 512;
+  int threads = 1;
+  int plain = 0;
+  int slow = 0;
+  int filter = 0;
+  int cz = 0;
+  voice_max = 1024;
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] != '-') continue;
+    switch (argv[i][1]) {
+      case 'V': voice_max = (int)strtol(&argv[i][2], NULL, 0); break;
+      case 'a': active = (int)strtol(&argv[i][2], NULL, 0); break;
+      case 'b': blocks = (int)strtol(&argv[i][2], NULL, 0); break;
+      case 'n': frames = (int)strtol(&argv[i][2], NULL, 0); break;
+      case 'w': threads = (int)strtol(&argv[i][2], NULL, 0); break;
+      case 'k':
+        synth_control_frames = (int)strtol(&argv[i][2], NULL, 0);
+        synth_control_default = (synth_control_frames > 1);
+        break;
+      case 'f': synth_arena_split = 0; break;
+      case 's': synth_simd_enable = 0; break;
+      case 'p': plain = 1; break;
+      case 'e': slow = 1; break;
+      case 'F': filter = 1; break;
+      case 'c': cz = 1; break;
+      default:
+        printf("# unknown switch '%s'\n", argv[i]);
+        return 1;
+    }
+  }
+  if (active < 1) active = 1;
+  if (frames < 1 || frames > ONE_FRAME_MAX) frames = SYNTH_FRAMES_PER_CALLBACK;
+
+  synth_init();
+  wave_table_init();
+  voice_init();
+  synth_pool_start(threads);
+  if (active > voice_max) active = voice_max;
+  patch(active, plain, slow, filter, cz);
+
+  float *buffer = (float *)calloc((size_t)frames * AUDIO_CHANNELS, sizeof(float));
+  if (buffer == NULL) {
+    puts("# out of memory");
+    return 1;
+  }
+
+  // settle the smoothers and envelopes first
+  for (int b = 0; b < 50; b++) synth(buffer, NULL, frames, AUDIO_CHANNELS, NULL);
+
+  int fd = l1_open();
+  l1_enable(fd, 1);
+  double a = now();
+  for (int b = 0; b < blocks; b++) synth(buffer, NULL, frames, AUDIO_CHANNELS, NULL);
+  double t = now() - a;
+  l1_enable(fd, 0);
+  long long misses = l1_read(fd);
+
+  double samples = (double)blocks * (double)frames;
+  double voice_samples = samples * (double)synth_active_count();
+  printf("# %d/%d voices, %s arena, %s kernel, %d threads\n",
+    synth_active_count(), voice_max,
+    synth_arena_split ? "hot/cold" : "flat",
+    synth_simd_available() ? synth_simd_name() : "scalar",
+    synth_pool_threads());
+  printf("# %.3fs for %.1fs of audio (%.1f%% of one core)\n",
+    t, samples / MAIN_SAMPLE_RATE, 100.0 * t / (samples / MAIN_SAMPLE_RATE));
+  printf("# %.2fns per voice sample\n", 1e9 * t / voice_samples);
+  if (misses >= 0) {
+    printf("# %.3f L1d read misses per voice sample\n", (double)misses / voice_samples);
+  } else {
+    printf("# L1d read misses n/a (no perf_event_open here)\n");
+  }
+
+  synth_pool_stop();
+  wave_free();
+  synth_free();
+  return 0;
+}
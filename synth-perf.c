@@ -0,0 +1,180 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "synth-perf.h"
+
+// The counters are one group led by cycles, so a single read() gets them
+// all at once and they are scheduled on and off the pmu together. They
+// follow the synth thread wherever it runs and are read from whichever
+// thread shows them, the difference since the last show divided by the
+// callbacks since then. A counter
+// the cpu or the kernel won't give us is left out of the group instead of
+// failing the lot (L1D misses are often missing in a vm).
+
+#ifdef __linux__
+static const struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} perf_event[SYNTH_PERF_EVENTS] = {
+  { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "l1d misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+  { "branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+#endif
+
+static struct {
+  volatile int request;    // what synth_perf_enable() asked for
+  volatile int tid;        // the synth thread's, 0 until its first callback
+  int open;                // the rest is only touched under perf_lock
+  int fd[SYNTH_PERF_EVENTS];
+  int slot[SYNTH_PERF_EVENTS]; // where each one is in a group read, -1 if not open
+  int count;
+  volatile int error;      // errno from opening cycles, 0 if it worked
+  uint64_t last[SYNTH_PERF_EVENTS]; // at the last show
+  uint64_t last_callbacks;
+  uint64_t callbacks;      // written by the synth thread only
+} perf = {};
+
+static pthread_mutex_t perf_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void synth_perf_callback(void) {
+#ifdef __linux__
+  // the one system call, on the first callback
+  if (perf.tid == 0) __atomic_store_n(&perf.tid, (int)syscall(SYS_gettid), __ATOMIC_RELEASE);
+#endif
+  __atomic_store_n(&perf.callbacks, perf.callbacks + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef __linux__
+static void perf_close(void) {
+  for (int k = 0; k < SYNTH_PERF_EVENTS; k++) {
+    if (perf.slot[k] >= 0) close(perf.fd[k]);
+    perf.slot[k] = -1;
+  }
+  perf.count = 0;
+  perf.open = 0;
+}
+
+static int perf_read(uint64_t *values) {
+  struct {
+    uint64_t nr;
+    uint64_t value[SYNTH_PERF_EVENTS];
+  } group;
+  if (perf.count == 0) return 0;
+  const ssize_t want = (ssize_t)sizeof(uint64_t) * (1 + perf.count);
+  if (read(perf.fd[0], &group, sizeof(group)) != want) return 0;
+  for (int k = 0; k < SYNTH_PERF_EVENTS; k++) {
+    values[k] = (perf.slot[k] >= 0) ? group.value[perf.slot[k]] : 0;
+  }
+  return 1;
+}
+
+static void perf_open(int tid) {
+  int leader = -1;
+  perf.count = 0;
+  for (int k = 0; k < SYNTH_PERF_EVENTS; k++) perf.slot[k] = -1;
+  for (int k = 0; k < SYNTH_PERF_EVENTS; k++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = perf_event[k].type;
+    attr.config = perf_event[k].config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.disabled = (leader < 0);
+    int fd = (int)syscall(SYS_perf_event_open, &attr, tid, -1, leader, 0);
+    if (fd < 0) {
+      if (leader < 0) {
+        __atomic_store_n(&perf.error, errno, __ATOMIC_RELAXED);
+        return;
+      }
+      continue;
+    }
+    if (leader < 0) leader = fd;
+    perf.fd[k] = fd;
+    perf.slot[k] = perf.count++;
+  }
+  __atomic_store_n(&perf.error, 0, __ATOMIC_RELAXED);
+  ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  perf.open = 1;
+  perf.last_callbacks = __atomic_load_n(&perf.callbacks, __ATOMIC_ACQUIRE);
+  if (!perf_read(perf.last)) memset(perf.last, 0, sizeof(perf.last));
+}
+
+// under perf_lock, opens or closes to match the request once the synth
+// thread is known
+static void perf_sync(void) {
+  const int tid = __atomic_load_n(&perf.tid, __ATOMIC_ACQUIRE);
+  const int want = synth_perf_enabled() && tid != 0;
+  if (want && !perf.open) perf_open(tid);
+  if (!want && perf.open) perf_close();
+}
+#endif
+
+void synth_perf_enable(int on) {
+  __atomic_store_n(&perf.request, on ? 1 : 0, __ATOMIC_RELEASE);
+#ifdef __linux__
+  pthread_mutex_lock(&perf_lock);
+  perf_sync();
+  pthread_mutex_unlock(&perf_lock);
+#endif
+}
+
+int synth_perf_enabled(void) {
+  return __atomic_load_n(&perf.request, __ATOMIC_ACQUIRE);
+}
+
+int synth_perf_show(char *out, int size) {
+#ifdef __linux__
+  if (!synth_perf_enabled()) return 0;
+  pthread_mutex_lock(&perf_lock);
+  perf_sync();
+  int n = 0;
+  uint64_t now[SYNTH_PERF_EVENTS];
+  const int error = __atomic_load_n(&perf.error, __ATOMIC_RELAXED);
+  if (error) {
+    n = snprintf(out, size, "# perf counters unavailable: %s%s\n", strerror(error),
+      (error == EACCES || error == EPERM) ? " (see /proc/sys/kernel/perf_event_paranoid)" : "");
+  } else if (!perf.open) {
+    n = snprintf(out, size, "# perf waiting for the synth thread\n");
+  } else if (!perf_read(now)) {
+    n = snprintf(out, size, "# perf counters unreadable\n");
+  } else {
+    const uint64_t callbacks = __atomic_load_n(&perf.callbacks, __ATOMIC_ACQUIRE);
+    const uint64_t count = callbacks - perf.last_callbacks;
+    if (count == 0) {
+      n = snprintf(out, size, "# perf no callbacks since last\n");
+    } else {
+      n = snprintf(out, size, "# perf %llu callbacks, each", (unsigned long long)count);
+      double avg[SYNTH_PERF_EVENTS];
+      for (int k = 0; k < SYNTH_PERF_EVENTS; k++) {
+        avg[k] = (double)(now[k] - perf.last[k]) / (double)count;
+        perf.last[k] = now[k];
+        if (n < size && perf.slot[k] >= 0) n += snprintf(out + n, size - n, " %.0f %s", avg[k], perf_event[k].name);
+      }
+      if (n < size && avg[0] > 0 && perf.slot[1] >= 0) n += snprintf(out + n, size - n, ", %.2f ipc", avg[1] / avg[0]);
+      if (n < size) n += snprintf(out + n, size - n, "\n");
+      perf.last_callbacks = callbacks;
+    }
+  }
+  pthread_mutex_unlock(&perf_lock);
+  return (n < size) ? n : size - 1;
+#else
+  if (!synth_perf_enabled()) return 0;
+  return snprintf(out, size, "# perf counters are linux only\n");
+#endif
+}
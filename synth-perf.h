@@ -0,0 +1,22 @@
+#ifndef _SYNTH_PERF_H_
+#define _SYNTH_PERF_H_
+
+// Hardware counters (cycles, instructions, L1D read misses, branch misses)
+// on the synth thread, from Linux perf_event_open(), off unless asked for.
+// The synth thread only notes its thread id and counts its callbacks;
+// opening, enabling and reading the counters all happen on the thread that
+// calls synth_perf_enable() or synth_perf_show(), attached to the synth
+// thread by id, so the audio path makes no system calls for them. What is
+// counted is the synth thread's user space work, synth() and the little
+// around it, not the pool's workers.
+
+#define SYNTH_PERF_EVENTS (4)
+
+void synth_perf_enable(int on); // any thread but the synth one
+int synth_perf_enabled(void);
+void synth_perf_callback(void); // synth thread, once a callback
+
+// per callback averages since the last call, for synth_stats()
+int synth_perf_show(char *out, int size);
+
+#endif
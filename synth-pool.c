@@ -0,0 +1,145 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#include "futex-compat.h"
+#include "util.h"
+#include "synth-pool.h"
+
+// Workers spin on the generation word for a while after each job, which
+// covers the gaps between the phases of one block, then sleep in a futex
+// until the next block.
+
+#define POOL_SPIN (1 << 14)
+
+static struct {
+  int workers; // threads besides the caller
+  pthread_t thread[SYNTH_POOL_MAX];
+  int index[SYNTH_POOL_MAX];
+  volatile uint32_t generation;
+  uint32_t sleeping;
+  int running;
+  synth_pool_fn_t fn;
+  void *ctx;
+  int items;
+  uint64_t claim; // generation << 32 | next item
+  int done;
+} pool = {};
+
+static inline void pool_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+// A worker only takes items of the generation it joined. claim moves to the
+// new generation before that job's fn, ctx and items are published, so a
+// worker that is late leaving one job can't take an item of the next: its
+// compare and swap needs the old generation still in claim.
+static void pool_work(uint32_t gen) {
+  for (;;) {
+    uint64_t c = __atomic_load_n(&pool.claim, __ATOMIC_ACQUIRE);
+    if ((uint32_t)(c >> 32) != gen) break;
+    int i = (int)(uint32_t)c;
+    if (i >= __atomic_load_n(&pool.items, __ATOMIC_ACQUIRE)) break;
+    if (!__atomic_compare_exchange_n(&pool.claim, &c, c + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) continue;
+    pool.fn(pool.ctx, i);
+    __atomic_add_fetch(&pool.done, 1, __ATOMIC_RELEASE);
+  }
+}
+
+static void *pool_main(void *arg) {
+  int k = *(int *)arg;
+  char name[16];
+  snprintf(name, sizeof(name), "synth-%d", k);
+  util_set_thread_name(name);
+  uint32_t seen = __atomic_load_n(&pool.generation, __ATOMIC_ACQUIRE);
+  while (__atomic_load_n(&pool.running, __ATOMIC_ACQUIRE)) {
+    uint32_t g = __atomic_load_n(&pool.generation, __ATOMIC_ACQUIRE);
+    for (int spin = 0; g == seen && spin < POOL_SPIN; spin++) {
+      pool_relax();
+      g = __atomic_load_n(&pool.generation, __ATOMIC_ACQUIRE);
+    }
+    if (g == seen) {
+      __atomic_add_fetch(&pool.sleeping, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&pool.generation, __ATOMIC_SEQ_CST) == seen) {
+        futex_wait_timeout(&pool.generation, seen, 100);
+      }
+      __atomic_sub_fetch(&pool.sleeping, 1, __ATOMIC_SEQ_CST);
+      continue;
+    }
+    seen = g;
+    pool_work(g);
+  }
+  return NULL;
+}
+
+int synth_pool_start(int threads) {
+  if (pool.workers) synth_pool_stop();
+  if (threads > SYNTH_POOL_MAX) threads = SYNTH_POOL_MAX;
+#ifdef __linux__
+  // spinning workers sharing a core would only slow the callback down
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus > 0 && threads > cpus) threads = (int)cpus;
+#endif
+  if (threads <= 1) return 1;
+  pool.running = 1;
+  for (int k = 0; k < threads - 1; k++) {
+    pool.index[k] = k + 1;
+    if (pthread_create(&pool.thread[k], NULL, pool_main, &pool.index[k]) != 0) {
+      printf("# synth pool could only start %d threads\n", k + 1);
+      break;
+    }
+#ifdef __linux__
+    // leave cpu 0 to the audio callback and everything else
+    if (cpus > 1) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET((k + 1) % cpus, &set);
+      pthread_setaffinity_np(pool.thread[k], sizeof(set), &set);
+    }
+#endif
+    pool.workers++;
+  }
+  printf("# synth pool %d threads\n", pool.workers + 1);
+  return pool.workers + 1;
+}
+
+void synth_pool_stop(void) {
+  if (pool.workers == 0) return;
+  __atomic_store_n(&pool.running, 0, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&pool.generation, 1, __ATOMIC_SEQ_CST);
+  futex_wake(&pool.generation, INT_MAX);
+  for (int k = 0; k < pool.workers; k++) pthread_join(pool.thread[k], NULL);
+  pool.workers = 0;
+}
+
+int synth_pool_threads(void) {
+  return pool.workers + 1;
+}
+
+void synth_pool_run(synth_pool_fn_t fn, void *ctx, int items) {
+  if (pool.workers == 0 || items <= 1) {
+    for (int i = 0; i < items; i++) fn(ctx, i);
+    return;
+  }
+  // only the audio thread moves the generation on while the pool runs
+  const uint32_t g = pool.generation + 1;
+  __atomic_store_n(&pool.claim, (uint64_t)g << 32, __ATOMIC_SEQ_CST);
+  pool.fn = fn;
+  pool.ctx = ctx;
+  __atomic_store_n(&pool.items, items, __ATOMIC_RELEASE);
+  __atomic_store_n(&pool.done, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&pool.generation, g, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&pool.sleeping, __ATOMIC_SEQ_CST)) futex_wake(&pool.generation, INT_MAX);
+  pool_work(g);
+  while (__atomic_load_n(&pool.done, __ATOMIC_ACQUIRE) < items) pool_relax();
+}
@@ -0,0 +1,17 @@
+#ifndef _SYNTH_POOL_H_
+#define _SYNTH_POOL_H_
+
+// Fork/join worker pool for the audio thread. synth_pool_run() hands out
+// items 0..items-1 to the workers and the caller, and returns once all of
+// them are done. Items must not depend on each other.
+
+#define SYNTH_POOL_MAX (16)
+
+typedef void (*synth_pool_fn_t)(void *ctx, int item);
+
+int synth_pool_start(int threads);
+void synth_pool_stop(void);
+int synth_pool_threads(void);
+void synth_pool_run(synth_pool_fn_t fn, void *ctx, int items);
+
+#endif
@@ -0,0 +1,677 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "skred.h"
+#include "synth-types.h"
+#include "synth.h"
+#include "synth-simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SIMD_NEON
+#endif
+
+// The kernels step a lane group of voices together one sample at a time and
+// do the same operations as osc_stage() and the amp/pan stages of
+// voice_render_block(), so they are a drop in for those voices. The caller
+// only hands over voices where the phase can't move by more than half a loop
+// per sample, which makes the wrap a single subtraction. Phases are 32.32
+// fixed point in 64 bit lanes (the NEON kernel needs aarch64 for that).
+
+#define LANES_MAX SYNTH_SIMD_LANES
+
+int synth_simd_enable = 1;
+
+typedef struct {
+  phase_t phase[LANES_MAX];
+  phase_t inc[LANES_MAX];
+  phase_t start[LANES_MAX];
+  phase_t end[LANES_MAX];
+  phase_t len[LANES_MAX];
+  int64_t stop[LANES_MAX];     // -1 if a wrap finishes the voice (one shot, no loop)
+  float amp[LANES_MAX];
+  float gain[LANES_MAX];
+  float smoothing[LANES_MAX];
+  float pan_left[LANES_MAX];
+  float pan_right[LANES_MAX];
+  int32_t smooth[LANES_MAX];   // -1 if the smoother is on
+  int32_t size_max[LANES_MAX];
+  const float *table[LANES_MAX];
+  float *out[LANES_MAX];
+  float *left[LANES_MAX];
+  float *right[LANES_MAX];
+  int32_t live[LANES_MAX];
+  int32_t finished[LANES_MAX];
+  block_t pad;                 // where the unused lanes write
+} lanes_t;
+
+static const float pad_table[1] = { 0.0f };
+
+static void lanes_load(lanes_t *g, const int *voices, int count, int lanes) {
+  for (int k = 0; k < lanes; k++) {
+    if (k >= count) {
+      g->phase[k] = 0;
+      g->inc[k] = 0;
+      g->start[k] = 0;
+      g->end[k] = PHASE_ONE;
+      g->len[k] = PHASE_ONE;
+      g->amp[k] = 0.0f;
+      g->gain[k] = 0.0f;
+      g->smoothing[k] = 0.0f;
+      g->pan_left[k] = 0.0f;
+      g->pan_right[k] = 0.0f;
+      g->smooth[k] = 0;
+      g->stop[k] = 0;
+      g->size_max[k] = 0;
+      g->table[k] = pad_table;
+      g->out[k] = g->left[k] = g->right[k] = g->pad;
+      continue;
+    }
+    int n = voices[k];
+    int looped = voice_loop_enabled[n] && voice_loop_valid[n];
+    g->phase[k] = voice_phase[n];
+    g->inc[k] = voice_direction[n] ? -voice_phase_step[n] : voice_phase_step[n];
+    g->start[k] = looped ? voice_loop_start_p[n] : 0;
+    g->end[k] = looped ? voice_loop_end_p[n] : (phase_t)voice_table_size[n] << PHASE_SHIFT;
+    g->len[k] = g->end[k] - g->start[k];
+    g->amp[k] = voice_amp[n];
+    g->gain[k] = voice_smoother_gain[n];
+    g->smoothing[k] = voice_smoother_smoothing[n];
+    g->pan_left[k] = voice_pan_left[n];
+    g->pan_right[k] = voice_pan_right[n];
+    g->smooth[k] = voice_smoother_enable[n] ? -1 : 0;
+    g->stop[k] = (voice_one_shot[n] && !voice_loop_enabled[n]) ? -1 : 0;
+    g->size_max[k] = voice_table_size[n] - 1;
+    g->table[k] = voice_table[n];
+    g->out[k] = voice_block[n];
+    g->left[k] = voice_block_left[n];
+    g->right[k] = voice_block_right[n];
+  }
+}
+
+static void lanes_store(lanes_t *g, const int *voices, int count, int frames, int *live) {
+  for (int k = 0; k < count; k++) {
+    int n = voices[k];
+    voice_phase[n] = g->phase[k];
+    voice_smoother_gain[n] = g->gain[k];
+    if (g->finished[k]) voice_finished[n] = 1;
+    voice_sample[n] = (g->live[k] < frames) ? 0.0f : voice_block[n][frames - 1];
+    live[k] = voice_disconnect[n] ? 0 : g->live[k];
+  }
+}
+
+// samples x lanes tile back out to each lane's blocks
+static void tile_store(float *const *dst, int i0, float tile[][LANES_MAX], int samples, int lanes) {
+  for (int k = 0; k < lanes; k++) {
+    float *d = dst[k] + i0;
+    for (int s = 0; s < samples; s++) d[s] = tile[s][k];
+  }
+}
+
+static void tile_load(float *const *src, int i0, float tile[][LANES_MAX], int samples, int lanes) {
+  for (int k = 0; k < lanes; k++) {
+    const float *d = src[k] + i0;
+    for (int s = 0; s < samples; s++) tile[s][k] = d[s];
+  }
+}
+
+// The filter bank runs the transposed direct form II biquad of
+// mmf_process() across a lane group of voices, in place on their blocks.
+// Lanes past live[] keep their state.
+
+typedef struct {
+  float b0[LANES_MAX];
+  float b1[LANES_MAX];
+  float b2[LANES_MAX];
+  float a1[LANES_MAX];
+  float a2[LANES_MAX];
+  float s1[LANES_MAX];
+  float s2[LANES_MAX];
+  int32_t live[LANES_MAX];
+  float *out[LANES_MAX];
+  block_t pad;
+} bank_t;
+
+static void bank_load(bank_t *b, const int *voices, const int *live, int count, int lanes) {
+  for (int k = 0; k < lanes; k++) {
+    if (k >= count) {
+      b->b0[k] = b->b1[k] = b->b2[k] = b->a1[k] = b->a2[k] = 0.0f;
+      b->s1[k] = b->s2[k] = 0.0f;
+      b->live[k] = 0;
+      b->out[k] = b->pad;
+      continue;
+    }
+    int n = voices[k];
+    b->b0[k] = voice_filter_b0[n];
+    b->b1[k] = voice_filter_b1[n];
+    b->b2[k] = voice_filter_b2[n];
+    b->a1[k] = voice_filter_a1[n];
+    b->a2[k] = voice_filter_a2[n];
+    b->s1[k] = voice_filter_s1[n];
+    b->s2[k] = voice_filter_s2[n];
+    b->live[k] = live[k];
+    b->out[k] = voice_block[n];
+  }
+}
+
+static void bank_store(const bank_t *b, const int *voices, int count) {
+  for (int k = 0; k < count; k++) {
+    voice_filter_s1[voices[k]] = b->s1[k];
+    voice_filter_s2[voices[k]] = b->s2[k];
+  }
+}
+
+#ifdef SIMD_X86
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+AVX2_TARGET static inline void transpose8(__m256 *r) {
+  __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+  __m256 t1 = _mm256_unpackhi_ps(r[0], r[1]);
+  __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]);
+  __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+  __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]);
+  __m256 t5 = _mm256_unpackhi_ps(r[4], r[5]);
+  __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]);
+  __m256 t7 = _mm256_unpackhi_ps(r[6], r[7]);
+  __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+  __m256 u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+  __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+  __m256 u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+  __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+  __m256 u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+  __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+  __m256 u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+  r[0] = _mm256_permute2f128_ps(u0, u4, 0x20);
+  r[1] = _mm256_permute2f128_ps(u1, u5, 0x20);
+  r[2] = _mm256_permute2f128_ps(u2, u6, 0x20);
+  r[3] = _mm256_permute2f128_ps(u3, u7, 0x20);
+  r[4] = _mm256_permute2f128_ps(u0, u4, 0x31);
+  r[5] = _mm256_permute2f128_ps(u1, u5, 0x31);
+  r[6] = _mm256_permute2f128_ps(u2, u6, 0x31);
+  r[7] = _mm256_permute2f128_ps(u3, u7, 0x31);
+}
+
+AVX2_TARGET static void block_store8(float *const *dst, int i0, __m256 *rows, int samples) {
+  if (samples == 8) {
+    transpose8(rows);
+    for (int k = 0; k < 8; k++) _mm256_storeu_ps(dst[k] + i0, rows[k]);
+  } else {
+    float tile[8][LANES_MAX];
+    for (int s = 0; s < samples; s++) _mm256_storeu_ps(tile[s], rows[s]);
+    tile_store(dst, i0, tile, samples, 8);
+  }
+}
+
+AVX2_TARGET static void block_load8(float *const *src, int i0, __m256 *rows, int samples) {
+  if (samples == 8) {
+    for (int k = 0; k < 8; k++) rows[k] = _mm256_loadu_ps(src[k] + i0);
+    transpose8(rows);
+  } else {
+    float tile[8][LANES_MAX];
+    tile_load(src, i0, tile, samples, 8);
+    for (int s = 0; s < samples; s++) rows[s] = _mm256_loadu_ps(tile[s]);
+  }
+}
+
+// the low 32 bits of each 64 bit lane of lo and hi, in lane order
+AVX2_TARGET static inline __m256i pack64(__m256i lo, __m256i hi) {
+  const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  return _mm256_permute2x128_si256(
+    _mm256_permutevar8x32_epi32(lo, even),
+    _mm256_permutevar8x32_epi32(hi, even), 0x20);
+}
+
+AVX2_TARGET static void render_avx2(lanes_t *g, int frames) {
+  // phases are two halves of four 64 bit lanes, [0] lanes 0-3, [1] lanes 4-7
+  __m256i phase[2], inc[2], start[2], end_stop[2], len[2], stop[2], alive64[2];
+  for (int h = 0; h < 2; h++) {
+    phase[h] = _mm256_loadu_si256((const __m256i *)&g->phase[h * 4]);
+    inc[h] = _mm256_loadu_si256((const __m256i *)&g->inc[h * 4]);
+    start[h] = _mm256_loadu_si256((const __m256i *)&g->start[h * 4]);
+    len[h] = _mm256_loadu_si256((const __m256i *)&g->len[h * 4]);
+    stop[h] = _mm256_loadu_si256((const __m256i *)&g->stop[h * 4]);
+    end_stop[h] = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i *)&g->end[h * 4]), _mm256_set1_epi64x(1));
+    alive64[h] = _mm256_set1_epi64x(-1);
+  }
+  const __m256 amp = _mm256_loadu_ps(g->amp);
+  __m256 gain = _mm256_loadu_ps(g->gain);
+  const __m256 smoothing = _mm256_loadu_ps(g->smoothing);
+  const __m256 pl = _mm256_loadu_ps(g->pan_left);
+  const __m256 pr = _mm256_loadu_ps(g->pan_right);
+  const __m256 smooth = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)g->smooth));
+  const __m256i size_max = _mm256_loadu_si256((const __m256i *)g->size_max);
+  const __m256i zero = _mm256_setzero_si256();
+
+  // tables are gathered relative to lane 0's table
+  const char *base = (const char *)g->table[0];
+  int64_t offset[LANES_MAX];
+  for (int k = 0; k < 8; k++) offset[k] = (const char *)g->table[k] - base;
+  const __m256i offset_lo = _mm256_loadu_si256((const __m256i *)&offset[0]);
+  const __m256i offset_hi = _mm256_loadu_si256((const __m256i *)&offset[4]);
+
+  __m256 alive = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+  __m256 finished = _mm256_setzero_ps();
+  __m256i live = zero;
+
+  for (int i0 = 0; i0 < frames; i0 += 8) {
+    int samples = frames - i0;
+    if (samples > 8) samples = 8;
+    __m256 o[8], l[8], r[8];
+    for (int s = 0; s < samples; s++) {
+      __m256i died64[2], frame[2];
+      for (int h = 0; h < 2; h++) {
+        __m256i p = _mm256_add_epi64(phase[h], inc[h]);
+        __m256i fwd = _mm256_cmpgt_epi64(p, end_stop[h]); // p >= end
+        __m256i bwd = _mm256_cmpgt_epi64(start[h], p);
+        __m256i pf = _mm256_blendv_epi8(_mm256_sub_epi64(p, len[h]), end_stop[h], stop[h]);
+        __m256i pb = _mm256_blendv_epi8(_mm256_add_epi64(p, len[h]), start[h], stop[h]);
+        p = _mm256_blendv_epi8(p, pf, fwd);
+        p = _mm256_blendv_epi8(p, pb, bwd);
+        phase[h] = _mm256_blendv_epi8(phase[h], p, alive64[h]);
+        died64[h] = _mm256_and_si256(_mm256_or_si256(fwd, bwd), _mm256_and_si256(stop[h], alive64[h]));
+        alive64[h] = _mm256_andnot_si256(died64[h], alive64[h]);
+        frame[h] = _mm256_srli_epi64(phase[h], PHASE_SHIFT);
+      }
+      __m256 died = _mm256_castsi256_ps(pack64(died64[0], died64[1]));
+
+      __m256i idx = pack64(frame[0], frame[1]);
+      idx = _mm256_min_epi32(_mm256_max_epi32(idx, zero), size_max);
+      __m256i lo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(idx));
+      __m256i hi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(idx, 1));
+      lo = _mm256_add_epi64(offset_lo, _mm256_slli_epi64(lo, 2));
+      hi = _mm256_add_epi64(offset_hi, _mm256_slli_epi64(hi, 2));
+      __m128 flo = _mm256_i64gather_ps((const float *)base, lo, 1);
+      __m128 fhi = _mm256_i64gather_ps((const float *)base, hi, 1);
+      __m256 f = _mm256_set_m128(fhi, flo);
+
+      __m256 next = _mm256_fmadd_ps(smoothing, _mm256_sub_ps(amp, gain), gain);
+      gain = _mm256_blendv_ps(gain, next, _mm256_and_ps(smooth, alive));
+      __m256 out = _mm256_mul_ps(f, _mm256_blendv_ps(amp, gain, smooth));
+      out = _mm256_and_ps(out, alive);
+      o[s] = out;
+      l[s] = _mm256_mul_ps(out, pl);
+      r[s] = _mm256_mul_ps(out, pr);
+
+      live = _mm256_sub_epi32(live, _mm256_castps_si256(alive));
+      finished = _mm256_or_ps(finished, died);
+      alive = _mm256_andnot_ps(died, alive);
+    }
+    block_store8(g->out, i0, o, samples);
+    block_store8(g->left, i0, l, samples);
+    block_store8(g->right, i0, r, samples);
+  }
+
+  _mm256_storeu_si256((__m256i *)&g->phase[0], phase[0]);
+  _mm256_storeu_si256((__m256i *)&g->phase[4], phase[1]);
+  _mm256_storeu_ps(g->gain, gain);
+  _mm256_storeu_si256((__m256i *)g->live, live);
+  _mm256_storeu_si256((__m256i *)g->finished, _mm256_castps_si256(finished));
+}
+
+AVX2_TARGET static void filter_avx2(bank_t *b, int frames) {
+  const __m256 b0 = _mm256_loadu_ps(b->b0);
+  const __m256 b1 = _mm256_loadu_ps(b->b1);
+  const __m256 b2 = _mm256_loadu_ps(b->b2);
+  const __m256 a1 = _mm256_loadu_ps(b->a1);
+  const __m256 a2 = _mm256_loadu_ps(b->a2);
+  const __m256i live = _mm256_loadu_si256((const __m256i *)b->live);
+  __m256 s1 = _mm256_loadu_ps(b->s1);
+  __m256 s2 = _mm256_loadu_ps(b->s2);
+
+  for (int i0 = 0; i0 < frames; i0 += 8) {
+    int samples = frames - i0;
+    if (samples > 8) samples = 8;
+    __m256 x[8];
+    block_load8(b->out, i0, x, samples);
+    for (int s = 0; s < samples; s++) {
+      __m256 alive = _mm256_castsi256_ps(_mm256_cmpgt_epi32(live, _mm256_set1_epi32(i0 + s)));
+      __m256 y = _mm256_fmadd_ps(b0, x[s], s1);
+      __m256 n1 = _mm256_fmadd_ps(b1, x[s], _mm256_fnmadd_ps(a1, y, s2));
+      __m256 n2 = _mm256_fnmadd_ps(a2, y, _mm256_mul_ps(b2, x[s]));
+      s1 = _mm256_blendv_ps(s1, n1, alive);
+      s2 = _mm256_blendv_ps(s2, n2, alive);
+      x[s] = _mm256_blendv_ps(x[s], y, alive);
+    }
+    block_store8(b->out, i0, x, samples);
+  }
+
+  _mm256_storeu_ps(b->s1, s1);
+  _mm256_storeu_ps(b->s2, s2);
+}
+
+// cz_position() for a lane group
+AVX2_TARGET static inline __m256 cz_position8(__m256 d, int steps) {
+  __m256 x = _mm256_mul_ps(d, _mm256_set1_ps((float)steps / CZ_D_MAX));
+  x = _mm256_max_ps(x, _mm256_setzero_ps());
+  return _mm256_min_ps(x, _mm256_set1_ps((float)steps));
+}
+
+AVX2_TARGET static inline __m256 cz_lerp8(const float *t, __m256i i, __m256 u) {
+  __m256 a = _mm256_i32gather_ps(t, i, 4);
+  __m256 b = _mm256_i32gather_ps(t + 1, i, 4);
+  return _mm256_fmadd_ps(u, _mm256_sub_ps(b, a), a);
+}
+
+typedef struct {
+  __m256 brk, s1, s2, o2; // segments
+  __m256i row;             // curves, the first of the two rows
+  __m256 u;
+} cz8_t;
+
+AVX2_TARGET static inline void cz_prepare8(cz8_t *z, int n, __m256 d) {
+  if (n == 6 || n == 7) {
+    __m256 x = cz_position8(d, CZ_CURVE_STEPS);
+    __m256i i = _mm256_cvttps_epi32(x);
+    z->u = _mm256_sub_ps(x, _mm256_cvtepi32_ps(i));
+    z->row = _mm256_mullo_epi32(i, _mm256_set1_epi32(CZ_CURVE_POINTS + 2));
+    return;
+  }
+  // cz_seg(), a lane at a time
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 half = _mm256_set1_ps(0.5f);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  d = _mm256_min_ps(_mm256_max_ps(d, zero), _mm256_set1_ps(CZ_D_MAX));
+  z->brk = one;
+  z->s1 = z->s2 = one;
+  z->o2 = zero;
+  switch (n) {
+    case 1:
+      z->brk = d;
+      z->s1 = _mm256_and_ps(_mm256_div_ps(half, d), _mm256_cmp_ps(d, zero, _CMP_GT_OQ));
+      z->s2 = _mm256_div_ps(half, _mm256_sub_ps(one, d));
+      z->o2 = _mm256_fnmadd_ps(d, z->s2, half);
+      break;
+    case 2:
+      z->brk = half;
+      z->s1 = z->s2 = _mm256_div_ps(half, _mm256_fnmadd_ps(d, half, half));
+      z->o2 = _mm256_sub_ps(one, z->s2);
+      break;
+    case 3:
+      z->brk = half;
+      z->s1 = z->s2 = _mm256_div_ps(half, _mm256_fnmadd_ps(d, half, half));
+      z->o2 = _mm256_fnmadd_ps(half, z->s2, half);
+      break;
+    case 4:
+      z->brk = half;
+      z->s1 = z->s2 = _mm256_set1_ps(2.0f);
+      z->o2 = _mm256_set1_ps(-1.0f);
+      break;
+    case 5:
+      z->brk = half;
+      z->s1 = _mm256_div_ps(half, _mm256_fnmadd_ps(d, half, half));
+      z->s2 = _mm256_div_ps(half, _mm256_fmadd_ps(d, half, half));
+      z->o2 = _mm256_fnmadd_ps(half, z->s2, half);
+      break;
+  }
+}
+
+AVX2_TARGET static inline __m256 cz_shape8(const cz8_t *z, int n, __m256 phase) {
+  if (n == 6 || n == 7) {
+    const float *c = &cz_curve[n - 6][0][0];
+    const float points = (float)CZ_CURVE_POINTS;
+    __m256 y = _mm256_mul_ps(phase, _mm256_set1_ps(points));
+    y = _mm256_max_ps(y, _mm256_setzero_ps());
+    y = _mm256_min_ps(y, _mm256_set1_ps(points));
+    __m256i j = _mm256_cvttps_epi32(y);
+    __m256 v = _mm256_sub_ps(y, _mm256_cvtepi32_ps(j));
+    __m256i r = _mm256_add_epi32(z->row, j);
+    __m256 a = cz_lerp8(c, r, v);
+    __m256 b = cz_lerp8(c + CZ_CURVE_POINTS + 2, r, v);
+    return _mm256_fmadd_ps(z->u, _mm256_sub_ps(b, a), a);
+  }
+  __m256 lo = _mm256_mul_ps(phase, z->s1);
+  __m256 hi = _mm256_fmadd_ps(phase, z->s2, z->o2);
+  return _mm256_blendv_ps(hi, lo, _mm256_cmp_ps(phase, z->brk, _CMP_LT_OQ));
+}
+
+AVX2_TARGET static void cz_avx2(int n, float *out, int live, const float *csrc, float d, float depth,
+  const float *table, int table_size) {
+  const __m256 size = _mm256_set1_ps((float)table_size);
+  const __m256 top = _mm256_set1_ps((float)(table_size - 1));
+  const __m256 dv = _mm256_set1_ps(d);
+  const __m256 depthv = _mm256_set1_ps(depth);
+  cz8_t z = { 0 };
+  if (!csrc) cz_prepare8(&z, n, dv);
+  for (int i0 = 0; i0 < live; i0 += 8) {
+    const int samples = (live - i0 < 8) ? live - i0 : 8;
+    float x[8] = { 0 }, c[8] = { 0 };
+    const float *xp = out + i0;
+    const float *cp = csrc ? csrc + i0 : NULL;
+    if (samples < 8) {
+      memcpy(x, xp, samples * sizeof(float));
+      if (cp) memcpy(c, cp, samples * sizeof(float));
+      xp = x;
+      if (cp) cp = c;
+    }
+    if (cp) cz_prepare8(&z, n, _mm256_fmadd_ps(_mm256_loadu_ps(cp), depthv, dv));
+    __m256 q = _mm256_mul_ps(cz_shape8(&z, n, _mm256_loadu_ps(xp)), size);
+    q = _mm256_min_ps(_mm256_max_ps(q, _mm256_setzero_ps()), top);
+    __m256 y = _mm256_i32gather_ps(table, _mm256_cvttps_epi32(q), 4);
+    if (samples == 8) {
+      _mm256_storeu_ps(out + i0, y);
+    } else {
+      _mm256_storeu_ps(x, y);
+      memcpy(out + i0, x, samples * sizeof(float));
+    }
+  }
+}
+
+#endif
+
+#ifdef SIMD_NEON
+
+// four lanes at a time, the lane group is done in two halves, and each
+// half's phases in two pairs of 64 bit lanes
+static void render_neon(lanes_t *g, int frames, int h) {
+  int64x2_t phase[2], inc[2], start[2], end_stop[2], len[2];
+  uint64x2_t stop[2], alive64[2];
+  for (int q = 0; q < 2; q++) {
+    const int k = h + q * 2;
+    phase[q] = vld1q_s64(&g->phase[k]);
+    inc[q] = vld1q_s64(&g->inc[k]);
+    start[q] = vld1q_s64(&g->start[k]);
+    end_stop[q] = vsubq_s64(vld1q_s64(&g->end[k]), vdupq_n_s64(1));
+    len[q] = vld1q_s64(&g->len[k]);
+    stop[q] = vreinterpretq_u64_s64(vld1q_s64(&g->stop[k]));
+    alive64[q] = vdupq_n_u64(~(uint64_t)0);
+  }
+  const float32x4_t amp = vld1q_f32(&g->amp[h]);
+  float32x4_t gain = vld1q_f32(&g->gain[h]);
+  const float32x4_t smoothing = vld1q_f32(&g->smoothing[h]);
+  const float32x4_t pl = vld1q_f32(&g->pan_left[h]);
+  const float32x4_t pr = vld1q_f32(&g->pan_right[h]);
+  const uint32x4_t smooth = vreinterpretq_u32_s32(vld1q_s32(&g->smooth[h]));
+  const int32x4_t size_max = vld1q_s32(&g->size_max[h]);
+  const int32x4_t zero = vdupq_n_s32(0);
+
+  uint32x4_t alive = vdupq_n_u32(0xffffffff);
+  uint32x4_t finished = vdupq_n_u32(0);
+  int32x4_t live = zero;
+
+  for (int i0 = 0; i0 < frames; i0 += 8) {
+    int samples = frames - i0;
+    if (samples > 8) samples = 8;
+    float to[8][LANES_MAX], tl[8][LANES_MAX], tr[8][LANES_MAX];
+    for (int s = 0; s < samples; s++) {
+      uint32x2_t died2[2];
+      int32x2_t frame[2];
+      for (int q = 0; q < 2; q++) {
+        int64x2_t p = vaddq_s64(phase[q], inc[q]);
+        uint64x2_t fwd = vcgtq_s64(p, end_stop[q]);
+        uint64x2_t bwd = vcltq_s64(p, start[q]);
+        int64x2_t pf = vbslq_s64(stop[q], end_stop[q], vsubq_s64(p, len[q]));
+        int64x2_t pb = vbslq_s64(stop[q], start[q], vaddq_s64(p, len[q]));
+        p = vbslq_s64(fwd, pf, p);
+        p = vbslq_s64(bwd, pb, p);
+        phase[q] = vbslq_s64(alive64[q], p, phase[q]);
+        uint64x2_t died = vandq_u64(vorrq_u64(fwd, bwd), vandq_u64(stop[q], alive64[q]));
+        alive64[q] = vbicq_u64(alive64[q], died);
+        died2[q] = vmovn_u64(died);
+        frame[q] = vmovn_s64(vshrq_n_s64(phase[q], PHASE_SHIFT));
+      }
+      uint32x4_t died = vcombine_u32(died2[0], died2[1]);
+
+      int32x4_t idx = vcombine_s32(frame[0], frame[1]);
+      idx = vminq_s32(vmaxq_s32(idx, zero), size_max);
+      int32_t ix[4];
+      vst1q_s32(ix, idx);
+      float fv[4];
+      for (int k = 0; k < 4; k++) fv[k] = g->table[h + k][ix[k]];
+      float32x4_t f = vld1q_f32(fv);
+
+      float32x4_t next = vfmaq_f32(gain, smoothing, vsubq_f32(amp, gain));
+      gain = vbslq_f32(vandq_u32(smooth, alive), next, gain);
+      float32x4_t out = vmulq_f32(f, vbslq_f32(smooth, gain, amp));
+      out = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(out), alive));
+      vst1q_f32(&to[s][h], out);
+      vst1q_f32(&tl[s][h], vmulq_f32(out, pl));
+      vst1q_f32(&tr[s][h], vmulq_f32(out, pr));
+
+      live = vsubq_s32(live, vreinterpretq_s32_u32(alive));
+      finished = vorrq_u32(finished, died);
+      alive = vbicq_u32(alive, died);
+    }
+    tile_store(&g->out[h], i0, (float (*)[LANES_MAX])&to[0][h], samples, 4);
+    tile_store(&g->left[h], i0, (float (*)[LANES_MAX])&tl[0][h], samples, 4);
+    tile_store(&g->right[h], i0, (float (*)[LANES_MAX])&tr[0][h], samples, 4);
+  }
+
+  vst1q_s64(&g->phase[h], phase[0]);
+  vst1q_s64(&g->phase[h + 2], phase[1]);
+  vst1q_f32(&g->gain[h], gain);
+  vst1q_s32(&g->live[h], live);
+  vst1q_s32(&g->finished[h], vreinterpretq_s32_u32(finished));
+}
+
+static void filter_neon(bank_t *b, int frames, int h) {
+  const float32x4_t b0 = vld1q_f32(&b->b0[h]);
+  const float32x4_t b1 = vld1q_f32(&b->b1[h]);
+  const float32x4_t b2 = vld1q_f32(&b->b2[h]);
+  const float32x4_t a1 = vld1q_f32(&b->a1[h]);
+  const float32x4_t a2 = vld1q_f32(&b->a2[h]);
+  const int32x4_t live = vld1q_s32(&b->live[h]);
+  float32x4_t s1 = vld1q_f32(&b->s1[h]);
+  float32x4_t s2 = vld1q_f32(&b->s2[h]);
+
+  for (int i0 = 0; i0 < frames; i0 += 8) {
+    int samples = frames - i0;
+    if (samples > 8) samples = 8;
+    float tx[8][LANES_MAX];
+    tile_load(&b->out[h], i0, (float (*)[LANES_MAX])&tx[0][h], samples, 4);
+    for (int s = 0; s < samples; s++) {
+      uint32x4_t alive = vcgtq_s32(live, vdupq_n_s32(i0 + s));
+      float32x4_t x = vld1q_f32(&tx[s][h]);
+      float32x4_t y = vfmaq_f32(s1, b0, x);
+      float32x4_t n1 = vfmaq_f32(vfmsq_f32(s2, a1, y), b1, x);
+      float32x4_t n2 = vfmsq_f32(vmulq_f32(b2, x), a2, y);
+      s1 = vbslq_f32(alive, n1, s1);
+      s2 = vbslq_f32(alive, n2, s2);
+      vst1q_f32(&tx[s][h], vbslq_f32(alive, y, x));
+    }
+    tile_store(&b->out[h], i0, (float (*)[LANES_MAX])&tx[0][h], samples, 4);
+  }
+
+  vst1q_f32(&b->s1[h], s1);
+  vst1q_f32(&b->s2[h], s2);
+}
+
+#endif
+
+enum {
+  SIMD_NONE,
+  SIMD_AVX2,
+  SIMD_NEON4,
+};
+
+static int simd_kind = SIMD_NONE;
+
+int synth_simd_init(void) {
+  simd_kind = SIMD_NONE;
+#ifdef SIMD_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) simd_kind = SIMD_AVX2;
+#endif
+#ifdef SIMD_NEON
+  simd_kind = SIMD_NEON4;
+#endif
+  printf("# synth kernel %s\n", synth_simd_name());
+  return simd_kind;
+}
+
+int synth_simd_available(void) {
+  return synth_simd_enable && simd_kind != SIMD_NONE;
+}
+
+const char *synth_simd_name(void) {
+  switch (simd_kind) {
+    case SIMD_AVX2: return "avx2";
+    case SIMD_NEON4: return "neon";
+  }
+  return "scalar";
+}
+
+void synth_simd_render(const int *voices, int count, int frames, int *live) {
+  lanes_t g;
+  for (int k = 0; k < count; k += LANES_MAX) {
+    int lanes = count - k;
+    if (lanes > LANES_MAX) lanes = LANES_MAX;
+    lanes_load(&g, &voices[k], lanes, LANES_MAX);
+    switch (simd_kind) {
+#ifdef SIMD_X86
+      case SIMD_AVX2: render_avx2(&g, frames); break;
+#endif
+#ifdef SIMD_NEON
+      case SIMD_NEON4:
+        render_neon(&g, frames, 0);
+        if (lanes > 4) render_neon(&g, frames, 4);
+        break;
+#endif
+      default: return;
+    }
+    lanes_store(&g, &voices[k], lanes, frames, &live[k]);
+  }
+}
+
+void synth_simd_filter(const int *voices, const int *live, int count, int frames) {
+  bank_t b;
+  for (int k = 0; k < count; k += LANES_MAX) {
+    int lanes = count - k;
+    if (lanes > LANES_MAX) lanes = LANES_MAX;
+    bank_load(&b, &voices[k], &live[k], lanes, LANES_MAX);
+    switch (simd_kind) {
+#ifdef SIMD_X86
+      case SIMD_AVX2: filter_avx2(&b, frames); break;
+#endif
+#ifdef SIMD_NEON
+      case SIMD_NEON4:
+        filter_neon(&b, frames, 0);
+        if (lanes > 4) filter_neon(&b, frames, 4);
+        break;
+#endif
+      default:
+        for (int j = 0; j < lanes; j++) {
+          float *out = voice_block[voices[k + j]];
+          for (int i = 0; i < live[k + j]; i++) out[i] = mmf_process(voices[k + j], out[i]);
+        }
+        continue;
+    }
+    bank_store(&b, &voices[k], lanes);
+  }
+}
+
+int synth_simd_cz(int n, float *out, int live, const float *csrc, float d, float depth,
+  const float *table, int table_size) {
+  if (!synth_simd_available()) return 0;
+  switch (simd_kind) {
+#ifdef SIMD_X86
+    case SIMD_AVX2: cz_avx2(n, out, live, csrc, d, depth, table, table_size); return 1;
+#endif
+  }
+  return 0; // NEON has no gather, the scalar loop is as good
+}
@@ -0,0 +1,29 @@
+#ifndef _SYNTH_SIMD_H_
+#define _SYNTH_SIMD_H_
+
+// Vector kernels for voices that need nothing but wavetable -> amp ->
+// smoother -> pan, and a filter bank for filtered voices.
+// synth_simd_init() picks one for this cpu at startup.
+
+#define SYNTH_SIMD_LANES (8)
+
+int synth_simd_init(void);
+int synth_simd_available(void);
+const char *synth_simd_name(void);
+
+// renders the listed voices across a block, live[k] gets the number of
+// samples voices[k] contributed (0 once it is finished or if it is muted)
+void synth_simd_render(const int *voices, int count, int frames, int *live);
+
+// runs the multi-mode filter of the listed voices over the first live[k]
+// samples of their blocks, in place, a lane group of voices at a time
+void synth_simd_filter(const int *voices, const int *live, int count, int frames);
+
+// reads table through cz mode n for a block of phases (0 to 1) in place,
+// see cz_stage(), returns 0 if there is no vector kernel for it
+int synth_simd_cz(int n, float *out, int live, const float *csrc, float d, float depth,
+  const float *table, int table_size);
+
+extern int synth_simd_enable;
+
+#endif
@@ -9,32 +9,108 @@ enum {
   FILTER_ALL_PASS = 5,
 };
 
-// Low-pass filter state structure
+// Multi-mode filter parameter tracking, the coefficients and state live in
+// the voice_filter_* arrays so a bank of voices can be filtered at once
 typedef struct {
-  float x1, x2;  // Input delay line
-  float y1, y2;  // Output delay line
-  float b0, b1, b2;  // Feedforward coefficients
-  float a1, a2;      // Feedback coefficients
-    
-  // Parameter tracking for coefficient updates
   float last_freq;
   float last_resonance;
   int last_mode;
 } mmf_t;
 
+enum {
+    ENV_IDLE,
+    ENV_ATTACK,
+    ENV_DECAY,
+    ENV_SUSTAIN,
+    ENV_RELEASE,
+    ENV_STAGES,
+};
+
 typedef struct {
     float a;
     float d;
     float s;
     float r;
-    float attack_time;    // attack duration in samples
-    float decay_time;     // decay duration in samples
     float sustain_level;     // 0 to 1
-    float release_time;   // release duration in samples
-    uint64_t sample_start;   // sample count when note is triggered
-    uint64_t sample_release; // sample count when note is released
-    int is_active;            // envelope state
+    int length[ENV_STAGES];  // stage durations in samples
+    float inverse[ENV_STAGES]; // 1 / length
+    int curve;               // 0 linear, 1 exponential
+    uint32_t gate;           // bumped by each note on
+    uint32_t release_gate;   // gate at the last note off
     float velocity; // multiply envelope by this value
+    // only the audio thread touches these
+    uint32_t seen_gate;
+    int stage;
+    int position;            // samples into the stage
+    float from;              // level the stage started at
+    float level;
 } envelope_t;
 
+// one voice's worth of samples for a render block
+typedef float block_t[SYNTH_BLOCK_FRAMES];
+
+// a noise voice's generator, sample k is a hash of key and count + k, and
+// the pink and brown filters' state
+typedef struct {
+  uint32_t key;
+  uint32_t count;
+  float b0, b1, b2;
+} noise_t;
+
+// CZ phase distortion transfer curves, see cz_seg(). Modes 1 to 5 (and 0,
+// no distortion) are two straight segments, y = s1 x below the break and
+// y = s2 x + o2 above it. Modes 6 and 7 are kept whole across the phase for
+// CZ_CURVE_STEPS + 1 values of d, with one spare entry on each axis to keep
+// the interpolation in bounds at the top.
+
+#define CZ_MODES (8)
+#define CZ_D_MAX (0.999f)
+#define CZ_CURVE_STEPS (128)
+#define CZ_CURVE_POINTS (256)
+
+typedef struct {
+  float brk;
+  float s1;
+  float s2;
+  float o2;
+} cz_seg_t;
+
+typedef float cz_curve_t[CZ_CURVE_STEPS + 2][CZ_CURVE_POINTS + 2];
+
+// Oscillator phase is 32.32 fixed point in table frames: the top half is
+// the frame, the bottom half the fraction, so a long sample keeps the same
+// precision at its end as at its start.
+typedef int64_t phase_t;
+
+#define PHASE_SHIFT (32)
+#define PHASE_ONE ((phase_t)1 << PHASE_SHIFT)
+#define PHASE_LIMIT (1 << 30) // frames, keeps a step and a wrap inside 63 bits
+
+static inline phase_t phase_from_frames(double frames) {
+  if (!(frames > -PHASE_LIMIT)) frames = -PHASE_LIMIT; // NaN as well
+  if (frames > PHASE_LIMIT) frames = PHASE_LIMIT;
+  return (phase_t)(frames * (double)PHASE_ONE);
+}
+
+static inline double phase_to_frames(phase_t p) {
+  return (double)p / (double)PHASE_ONE;
+}
+
+// How long synth() takes per callback, as a share of the audio it rendered
+// (1 is the whole period). Only the audio thread writes it, see
+// synth_timing_get(). The buckets are 8 to a doubling, from 0.1% of the
+// period up, the last one holding everything past 16 periods.
+#define SYNTH_TIMING_BUCKETS (112)
+
+typedef struct {
+  uint64_t callbacks;
+  uint64_t over;      // took longer than their period, the device ran dry
+  uint64_t late;      // came more than two periods after the one before
+  uint64_t ns;        // in synth() altogether
+  uint64_t frames;
+  float last;
+  float peak;
+  uint64_t bucket[SYNTH_TIMING_BUCKETS];
+} synth_timing_t;
+
 #endif
@@ -8,75 +8,142 @@
 #include "synth-types.h"
 
 #include "miniwav.h"
+#include "synth-simd.h"
+#include "synth-pool.h"
+#include "synth-perf.h"
+#include "latency.h"
 
-#define USE_PRE
+// Every synth.def array lives in one arena sized for voice_max voices,
+// each array starting on its own cache line. The HOT arrays come first so
+// what the renderer reads each block sits together, away from the COLD
+// ones.
 
-// #undef USE_PRE
+#define SYNTH_ALIGN (64)
 
-#ifdef USE_PRE
+enum {
+  SYNTH_HEAT_COLD,
+  SYNTH_HEAT_HOT,
+};
 
-#define ARRAY(type, name, size, init) type name[size] = init;
+int voice_max = VOICE_DEFAULT;
+int synth_arena_split = 1; // 0 lays the arrays out in synth.def order
+int synth_control_frames = SYNTH_CONTROL_FRAMES;
+int synth_control_default = 0; // what k a voice starts with, -k<n> at startup turns it on
+
+#define ARRAY(type, name, size, init, heat) type *name;
 #include "synth.def"
 #undef ARRAY
 
-#else
-
-#define ARRAY(type, name, size, init) type *name;
+#define ARRAY(type, name, size, init, heat) int name##__len__;
 #include "synth.def"
 #undef ARRAY
 
-#endif
+static void *synth_arena = NULL;
+static size_t synth_arena_size = 0;
 
-#define ARRAY(type, name, size, init) int name##__len__ = size;
-#include "synth.def"
-#undef ARRAY
+// Per voice stems, planar: voice n's left samples for the last callback
+// start at ((n * AUDIO_CHANNELS) + 0) * synth_stem_frames, then its right.
+// Only voices with voice_record[] set are written, and only their pages
+// are ever touched, so the buffer costs nothing for voices nobody reads.
+static float *synth_stem_buffer = NULL;
+int synth_stem_frames = 0;
+static int synth_stem_live = 0; // this callback's period fits the stems
 
 #include <math.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+static void synth_render_init(void);
+static void env_curve_init(void);
+static void svf_tan_init(void);
+static void cz_table_init(void);
+static void synth_render_free(void);
+
+static size_t synth_align(size_t n) {
+  return (n + SYNTH_ALIGN - 1) & ~(size_t)(SYNTH_ALIGN - 1);
+}
+
 void synth_init(void) {
+  if (voice_max < 1) voice_max = 1;
+  if (voice_max > VOICE_LIMIT) voice_max = VOICE_LIMIT;
+  if (synth_control_frames < 1) synth_control_frames = 1;
+  if (synth_control_frames > SYNTH_BLOCK_FRAMES) synth_control_frames = SYNTH_BLOCK_FRAMES;
+
+#define ARRAY(type, name, size, init, heat) name##__len__ = size;
+#include "synth.def"
+#undef ARRAY
 
   if (debug) {
-#define ARRAY(type, name, size, init) printf("%s : %d\n", #name, name##__len__);
+#define ARRAY(type, name, size, init, heat) printf("%s : %d %s\n", #name, name##__len__, #heat);
 #include "synth.def"
 #undef ARRAY
   }
 
-#ifdef USE_PRE
-
-  printf("# synth_init :: USE_PRE\n");
-
-#else
-
-  printf("# synth_init :: USE_MALLOC\n");
-#define ARRAY(type, name, size, init) name = (type*)malloc(size * sizeof(type));
+  size_t total = 0;
+  size_t hot = 0;
+#define ARRAY(type, name, size, init, heat) \
+  total += synth_align(name##__len__ * sizeof(type)); \
+  if (SYNTH_HEAT_##heat == SYNTH_HEAT_HOT) hot += synth_align(name##__len__ * sizeof(type));
 #include "synth.def"
 #undef ARRAY
 
-#define ARRAY(type, name, size, init) if (name == NULL) printf("malloc %s failed\n", #name);
+  synth_arena = calloc(1, total + SYNTH_ALIGN);
+  if (synth_arena == NULL) {
+    printf("# synth_init :: arena of %zu bytes failed\n", total);
+    exit(1);
+  }
+  synth_arena_size = total;
+
+  char *next = (char *)synth_align((size_t)synth_arena);
+  for (int pass = 0; pass < 2; pass++) {
+#define ARRAY(type, name, size, init, heat) \
+    if ((!synth_arena_split || SYNTH_HEAT_##heat == SYNTH_HEAT_HOT) == (pass == 0)) { \
+      name = (type *)next; \
+      next += synth_align(name##__len__ * sizeof(type)); \
+    }
 #include "synth.def"
 #undef ARRAY
+  }
 
-#endif
+  printf("# synth_init :: %d voices, %zu byte arena (%zu hot)\n", voice_max, synth_arena_size, hot);
+
+  synth_render_init();
+  env_curve_init();
+  svf_tan_init();
+  cz_table_init();
+  synth_simd_init();
 }
 
 void synth_free(void) {
-#ifdef USE_PRE
-
-  printf("# synth_free :: USE_PRE\n");
-  //
-  
-#else
-  
-  printf("# synth_free :: USE_FREE\n");
-
-#define ARRAY(type, name, size, init) free(name);
+  printf("# synth_free\n");
+  synth_render_free();
+  free(synth_stem_buffer);
+  synth_stem_buffer = NULL;
+  synth_stem_frames = 0;
+  free(synth_arena);
+  synth_arena = NULL;
+#define ARRAY(type, name, size, init, heat) name = NULL;
 #include "synth.def"
 #undef ARRAY
+}
 
-#endif
+int synth_stem_init(int frames) {
+  free(synth_stem_buffer);
+  synth_stem_buffer = NULL;
+  synth_stem_frames = 0;
+  if (frames <= 0) return 0;
+  synth_stem_buffer = (float *)calloc((size_t)voice_max * AUDIO_CHANNELS * frames, sizeof(float));
+  if (synth_stem_buffer == NULL) {
+    printf("# no stem buffer for %d frames\n", frames);
+    return 0;
+  }
+  synth_stem_frames = frames;
+  return frames;
+}
+
+float *synth_stem(int voice, int channel) {
+  return synth_stem_buffer + ((size_t)voice * AUDIO_CHANNELS + channel) * synth_stem_frames;
 }
 
 int requested_synth_frames_per_callback = SYNTH_FRAMES_PER_CALLBACK;
@@ -101,6 +168,8 @@ int volume_set(float v) {
 
 void audio_rng_init(uint64_t *rng, uint64_t seed);
 float audio_rng_float(uint64_t *rng);
+void synth_active_touch(void);
+void voice_features_update(int v);
 
 void audio_rng_init(uint64_t *rng, uint64_t seed) {
   *rng = seed ? seed : 1; // Ensure non-zero seed
@@ -131,147 +200,206 @@ float osc_get_phase_inc(int v, float f) {
   return phase_inc;
 }
 
+// the fixed point step is worked out in double, table_rate cancels
 void osc_set_freq(int v, float f) {
   voice_phase_inc[v] = osc_get_phase_inc(v, f);
+  double g = f;
+  if (voice_one_shot[v]) g /= voice_offset_hz[v];
+  voice_phase_step[v] = phase_from_frames(g * (double)voice_table_size[v] / MAIN_SAMPLE_RATE);
 }
 
-// Fast power approximation using bit manipulation
-// About 10x faster than powf, ~1-2% max error for your use case
-static inline float fast_pow(float a, float b) {
-    // Clamp input to avoid undefined behavior
-    if (a <= 0.0f) return 0.0f;
-    
-    union { float f; int i; } u = { a };
-    u.i = (int)(b * (u.i - 1065353216) + 1065353216);
-    return u.f;
+// Casio CZ style phase distortion, a transfer curve from the phase (0 to 1)
+// to the phase the table is read at, bent by the distortion d (0 to 1).
+// Modes 1 to 5 are two straight segments whose break, slopes and offset
+// are worked out from d exactly, once a block when d is fixed and once a
+// sample when it is modulated, so the curve is the one the CZ formulas
+// give for every d. The power curves of modes 6 and 7 are tabulated over
+// d and the phase and interpolated, which saves a pow a sample. There is
+// no switch on the mode per sample. cz_stage() runs over a block's worth
+// of phases at once, through synth_simd_cz() where there is a vector
+// kernel, which does the same operations in the same order.
+
+cz_curve_t cz_curve[2];
+
+// mode n's segments at distortion d, clamped to 0 to CZ_D_MAX
+static inline cz_seg_t cz_seg(int n, float d) {
+  cz_seg_t g = { 1.0f, 1.0f, 1.0f, 0.0f };
+  d = (d > 0.0f) ? d : 0.0f;
+  d = (d < CZ_D_MAX) ? d : CZ_D_MAX;
+  switch (n) {
+    case 1: // saw -> pulse
+      g.brk = d;
+      g.s1 = (d > 0.0f) ? 0.5f / d : 0.0f;
+      g.s2 = 0.5f / (1.0f - d);
+      g.o2 = 0.5f - d * g.s2;
+      break;
+    case 2: // square (folded sine)
+      g.brk = 0.5f;
+      g.s1 = g.s2 = 0.5f / (0.5f - d * 0.5f);
+      g.o2 = 1.0f - g.s2;
+      break;
+    case 3: // triangle
+      g.brk = 0.5f;
+      g.s1 = g.s2 = 0.5f / (0.5f - d * 0.5f);
+      g.o2 = 0.5f - 0.5f * g.s2;
+      break;
+    case 4: // double sine
+      g.brk = 0.5f;
+      g.s1 = g.s2 = 2.0f;
+      g.o2 = -1.0f;
+      break;
+    case 5: // saw -> triangle
+      g.brk = 0.5f;
+      g.s1 = 0.5f / (0.5f - d * 0.5f);
+      g.s2 = 0.5f / (0.5f + d * 0.5f);
+      g.o2 = 0.5f - 0.5f * g.s2;
+      break;
+  }
+  return g;
 }
 
-float cz_phasor(int n, float p, float d, int table_size) {
-    const float table_size_f = (float)table_size;
-    float phase = p / table_size_f;
-    
-    // Clamp d to safe range [0, 1)
-    d = (d < 0.0f) ? 0.0f : (d > 0.999f ? 0.999f : d);
-    
-    switch (n) {
-        case 1: { // saw -> pulse
-            const float inv_d = 0.5f / d;
-            const float inv_1_minus_d = 0.5f / (1.0f - d);
-            if (phase < d) {
-                phase *= inv_d;
-            } else {
-                phase = 0.5f + (phase - d) * inv_1_minus_d;
-            }
-            break;
-        }
-        case 2: { // square (folded sine)
-            const float half_d = d * 0.5f;
-            const float scale = 0.5f / (0.5f - half_d);
-            if (phase < 0.5f) {
-                phase *= scale;
-            } else {
-                phase = 1.0f - (1.0f - phase) * scale;
-            }
-            break;
-        }
-        case 3: { // triangle
-            const float half_d = d * 0.5f;
-            const float scale = 0.5f / (0.5f - half_d);
-            if (phase < 0.5f) {
-                phase *= scale;
-            } else {
-                phase = 0.5f + (phase - 0.5f) * scale;
-            }
-            break;
-        }
-        case 4: { // double sine
-            // phase *= 2.0f;
-            // if (phase >= 1.0f) phase -= 1.0f;
-            phase = fmodf(phase * 2.0f, 1.0f);
-            break;
-        }
-        case 5: { // saw -> triangle
-            const float half_d = d * 0.5f;
-            const float scale1 = 0.5f / (0.5f - half_d);
-            const float scale2 = 0.5f / (0.5f + half_d);
-            if (phase < 0.5f) {
-                phase *= scale1;
-            } else {
-                phase = 0.5f + (phase - 0.5f) * scale2;
-            }
-            break;
-        }
-        case 6: // resonant 1
-            phase = fast_pow(phase, 1.0f + 4.0f * d);
-            break;
-        case 7: // resonant 2
-            phase = fast_pow(phase, 1.0f + 8.0f * d);
-            break;
-        default:
-            return p;
+static inline float cz_line(const cz_seg_t *g, float phase) {
+  return (phase < g->brk) ? phase * g->s1 : phase * g->s2 + g->o2;
+}
+
+static void cz_table_init(void) {
+  for (int c = 0; c < 2; c++) {
+    const float depth = c ? 8.0f : 4.0f; // resonant 1, resonant 2
+    for (int i = 0; i <= CZ_CURVE_STEPS + 1; i++) {
+      const int k = (i > CZ_CURVE_STEPS) ? CZ_CURVE_STEPS : i;
+      const float e = 1.0f + depth * CZ_D_MAX * (float)k / (float)CZ_CURVE_STEPS;
+      for (int j = 0; j <= CZ_CURVE_POINTS; j++) {
+        cz_curve[c][i][j] = powf((float)j / (float)CZ_CURVE_POINTS, e);
+      }
+      cz_curve[c][i][CZ_CURVE_POINTS + 1] = 1.0f;
     }
-    
-    return phase * table_size_f;
+  }
 }
 
-float osc_next(int voice, float phase_inc) {
-    if (voice_finished[voice]) return 0.0f;
-    
-    const int table_size = voice_table_size[voice];
-    const bool one_shot = voice_one_shot[voice];
-    const bool loop_enabled = voice_loop_enabled[voice];
-    
-    if (voice_direction[voice]) phase_inc = -phase_inc;
-    
-    float phase = voice_phase[voice] + phase_inc;
-    
-    if (!isfinite(phase)) {
-        voice_phase[voice] = 0.0f;
-        voice_finished[voice] = one_shot;
-        return 0.0f;
+// d as a position along a table of steps + 1 entries, clamped like the
+// distortion always was
+static inline float cz_position(float d, int steps) {
+  float x = d * ((float)steps / CZ_D_MAX);
+  x = (x > 0.0f) ? x : 0.0f;
+  return (x < (float)steps) ? x : (float)steps;
+}
+
+// phase 0 to 1 through the power curve of mode 6 or 7 at distortion d
+static inline float cz_power(int n, float phase, float d) {
+  const float (*curve)[CZ_CURVE_POINTS + 2] = cz_curve[n - 6];
+  const float x = cz_position(d, CZ_CURVE_STEPS);
+  const int i = (int)x;
+  const float u = x - (float)i;
+  float y = phase * (float)CZ_CURVE_POINTS;
+  y = (y > 0.0f) ? y : 0.0f;
+  y = (y < (float)CZ_CURVE_POINTS) ? y : (float)CZ_CURVE_POINTS;
+  const int j = (int)y;
+  const float v = y - (float)j;
+  const float a = curve[i][j] + v * (curve[i][j + 1] - curve[i][j]);
+  const float b = curve[i + 1][j] + v * (curve[i + 1][j + 1] - curve[i + 1][j]);
+  return a + u * (b - a);
+}
+
+// phase 0 to 1 through mode n's transfer curve at distortion d
+static inline float cz_shape(int n, float phase, float d) {
+  if (n == 6 || n == 7) return cz_power(n, phase, d);
+  const cz_seg_t g = cz_seg(n, d);
+  return cz_line(&g, phase);
+}
+
+// out[] holds phases 0 to 1 and gets the table read through mode n at
+// distortion d, plus csrc[] * depth when there is a modulator
+static void cz_stage(int n, float *out, int live, const float *csrc, float d, float depth,
+  const float *table, int table_size) {
+  if (synth_simd_cz(n, out, live, csrc, d, depth, table, table_size)) return;
+  const float top = (float)(table_size - 1);
+  const float size = (float)table_size;
+  const cz_seg_t fixed = cz_seg(n, d);
+  for (int i = 0; i < live; i++) {
+    float q;
+    if (n == 6 || n == 7) {
+      q = cz_power(n, out[i], csrc ? d + csrc[i] * depth : d);
+    } else if (csrc) {
+      const cz_seg_t g = cz_seg(n, d + csrc[i] * depth);
+      q = cz_line(&g, out[i]);
+    } else {
+      q = cz_line(&fixed, out[i]);
     }
-    
-    // Get loop boundaries (precomputed if available)
-    const float loop_start = loop_enabled && voice_loop_valid[voice] 
-        ? voice_loop_start_f[voice] : 0.0f;
-    const float loop_end = loop_enabled && voice_loop_valid[voice]
-        ? voice_loop_end_f[voice] : (float)table_size;
-    const float loop_length = loop_end - loop_start;
-    
-    // Wrap phase
-    if (phase >= loop_end) {
-        if (one_shot && !loop_enabled) {
-            phase = loop_end - 1e-6f;
-            voice_finished[voice] = 1;
-        } else {
-            phase = loop_start + fmodf(phase - loop_start, loop_length);
-        }
-    } else if (phase < loop_start) {
-        if (one_shot && !loop_enabled) {
-            phase = loop_start;
-            voice_finished[voice] = 1;
-        } else {
-            phase = loop_end - fmodf(loop_start - phase, loop_length);
-        }
+    q *= size;
+    q = (q > 0.0f) ? q : 0.0f;
+    q = (q < top) ? q : top;
+    out[i] = table[(int)q];
+  }
+}
+
+float cz_phasor(int n, float p, float d, int table_size) {
+    if (n < 1 || n >= CZ_MODES) return p;
+    const float table_size_f = (float)table_size;
+    return cz_shape(n, p / table_size_f, d) * table_size_f;
+}
+
+// Noise
+//
+// Each noise voice has its own counter based generator: sample k is a hash
+// of the voice's key and k, so no two voices are correlated and a block of
+// white noise has no dependency from one sample to the next, which lets the
+// compiler vectorize it. Pink (Paul Kellet's economy filter) and brown (a
+// leaky integrator) are run over the white block afterwards.
+
+static inline int wave_is_noise(int w) {
+  return w >= WAVE_TABLE_NOISE_ALT && w <= WAVE_TABLE_NOISE_BROWN;
+}
+
+// lowbias32, Chris Wellons' integer hash
+static inline uint32_t noise_hash(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352dU;
+  x ^= x >> 15;
+  x *= 0x846ca68bU;
+  x ^= x >> 16;
+  return x;
+}
+
+static void noise_seed(int v) {
+  voice_noise[v].key = noise_hash((uint32_t)v + 1);
+  voice_noise[v].count = 0;
+  voice_noise[v].b0 = voice_noise[v].b1 = voice_noise[v].b2 = 0.0f;
+}
+
+// colours a block of white noise in place
+static void noise_colour(noise_t *z, int wave, float *out, int frames) {
+  if (wave == WAVE_TABLE_NOISE_PINK) {
+    float b0 = z->b0, b1 = z->b1, b2 = z->b2;
+    for (int i = 0; i < frames; i++) {
+      const float w = out[i];
+      b0 = 0.99765f * b0 + w * 0.0990460f;
+      b1 = 0.96300f * b1 + w * 0.2965164f;
+      b2 = 0.57000f * b2 + w * 1.0526913f;
+      out[i] = (b0 + b1 + b2 + w * 0.1848f) * 0.2f;
     }
-    
-    voice_phase[voice] = phase;
-    
-    // Get sample
-    int idx;
-    if (voice_cz_mode[voice]) {
-        int dv = voice_cz_mod_osc[voice];
-        float dm = (dv >= 0) ? voice_sample[dv] * voice_cz_mod_depth[voice] : 1.0f;
-        idx = (int)cz_phasor(voice_cz_mode[voice], phase, 
-                             voice_cz_distortion[voice] + dm, table_size);
-    } else {
-        idx = (int)phase;
+    z->b0 = b0;
+    z->b1 = b1;
+    z->b2 = b2;
+  } else if (wave == WAVE_TABLE_NOISE_BROWN) {
+    float b0 = z->b0;
+    for (int i = 0; i < frames; i++) {
+      b0 = (b0 + 0.02f * out[i]) * (1.0f / 1.02f);
+      out[i] = b0 * 3.5f;
     }
-    
-    if (idx >= table_size) idx = table_size - 1;
-    if (idx < 0) idx = 0;
-    
-    return voice_table[voice][idx];
+    z->b0 = b0;
+  }
+}
+
+static void noise_stage(int n, float *out, int frames) {
+  noise_t *z = &voice_noise[n];
+  const uint32_t key = z->key;
+  const uint32_t count = z->count;
+  for (int i = 0; i < frames; i++) {
+    const uint32_t h = noise_hash((count + (uint32_t)i) * 0x9e3779b9U ^ key);
+    out[i] = (float)(int32_t)h * (1.0f / 2147483648.0f);
+  }
+  z->count = count + (uint32_t)frames;
+  noise_colour(z, voice_wave_table_index[n], out, frames);
 }
 
 void osc_set_wave_table_index(int voice, int wave) {
@@ -296,8 +424,8 @@ void osc_set_wave_table_index(int voice, int wave) {
     //
     int start = voice_loop_start[voice];
     int end = voice_loop_end[voice];
-    voice_loop_start_f[voice] = (float)start;
-    voice_loop_end_f[voice] = (float)end;
+    voice_loop_start_p[voice] = (phase_t)start << PHASE_SHIFT;
+    voice_loop_end_p[voice] = (phase_t)end << PHASE_SHIFT;
     if (end > start) {
       voice_loop_valid[voice] = 1;
       voice_loop_length[voice] = (float)(end - start);
@@ -310,6 +438,8 @@ void osc_set_wave_table_index(int voice, int wave) {
     if (update_freq) {
       osc_set_freq(voice, voice_freq[voice]);
     }
+    voice_features_update(voice);
+    synth_active_touch();
   }
 }
 
@@ -318,24 +448,25 @@ void osc_trigger(int voice) {
     
     if (voice_one_shot[voice]) {
         if (voice_direction[voice]) {
-            voice_phase[voice] = (float)(voice_table_size[voice] - 1);
+            voice_phase[voice] = (phase_t)(voice_table_size[voice] - 1) << PHASE_SHIFT;
         } else {
-            voice_phase[voice] = 0.0f;
+            voice_phase[voice] = 0;
         }
     } else {
         // Preserve direction, but start at appropriate boundary
         if (voice_direction[voice]) {
             // Backward playback: start at loop end
             voice_phase[voice] = voice_loop_enabled[voice] 
-                ? (float)voice_loop_end[voice] - 1e-6f  // or voice_loop_end_f[voice]
-                : (float)(voice_table_size[voice] - 1);
+                ? ((phase_t)voice_loop_end[voice] << PHASE_SHIFT) - 1
+                : (phase_t)(voice_table_size[voice] - 1) << PHASE_SHIFT;
         } else {
             // Forward playback: start at loop start
             voice_phase[voice] = voice_loop_enabled[voice] 
-                ? (float)voice_loop_start[voice]  // or voice_loop_start_f[voice]
-                : 0.0f;
+                ? (phase_t)voice_loop_start[voice] << PHASE_SHIFT
+                : 0;
         }
     }
+    synth_active_touch();
 }
 
 float quantize_bits_int(float v, int bits) {
@@ -346,287 +477,1479 @@ float quantize_bits_int(float v, int bits) {
 
 // Process a single sample through the filter - VERY FAST
 // Only multiplication and addition, no transcendental functions
+//
+// Transposed Direct Form II, two state words instead of four and the
+// state stays close to the signal level at low cutoffs where DF-I sums big
+// terms that nearly cancel. Where the compiler has fused multiply-add this is
+// written out as the same fmas synth_simd_filter() uses so the vector bank
+// and this give the same samples.
 float mmf_process(int n, float input) {
-    // Calculate output using Direct Form II - only 5 multiplies, 4 adds
-    float output = voice_filter[n].b0 * input +
-                  voice_filter[n].b1 * voice_filter[n].x1 +
-                  voice_filter[n].b2 * voice_filter[n].x2 -
-                  voice_filter[n].a1 * voice_filter[n].y1 -
-                  voice_filter[n].a2 * voice_filter[n].y2;
-    
-    // Update delay lines
-    voice_filter[n].x2 = voice_filter[n].x1;
-    voice_filter[n].x1 = input;
-    voice_filter[n].y2 = voice_filter[n].y1;
-    voice_filter[n].y1 = output;
-    
+    const float b0 = voice_filter_b0[n];
+    const float b1 = voice_filter_b1[n];
+    const float b2 = voice_filter_b2[n];
+    const float a1 = voice_filter_a1[n];
+    const float a2 = voice_filter_a2[n];
+    const float s1 = voice_filter_s1[n];
+    const float s2 = voice_filter_s2[n];
+#if defined(__FMA__) || defined(__ARM_FEATURE_FMA)
+    float output = fmaf(b0, input, s1);
+    voice_filter_s1[n] = fmaf(b1, input, fmaf(-a1, output, s2));
+    voice_filter_s2[n] = fmaf(-a2, output, b2 * input);
+#else
+    float output = b0 * input + s1;
+    voice_filter_s1[n] = b1 * input - a1 * output + s2;
+    voice_filter_s2[n] = b2 * input - a2 * output;
+#endif
     return output;
 }
 
+// The modulated filter is a topology preserving transform state variable
+// filter, which stays stable and in tune when its cutoff and resonance move
+// every sample. Its only transcendental, the prewarped g = tan(pi fc / fs),
+// comes from svf_tan[] indexed by the cutoff in SVF_STEPS per octave above
+// SVF_LOW, so cutoff modulation in octaves is an add and a lerp.
+
+#define SVF_LOW (10.0f)
+#define SVF_STEPS (48)
+#define SVF_OCTAVES (11)
+#define SVF_TOP ((float)(SVF_STEPS * SVF_OCTAVES))
+#define SVF_Q_MIN (0.1f)
+#define SVF_Q_MAX (40.0f)
+
+static float svf_tan[SVF_STEPS * SVF_OCTAVES + 2];
+
+static void svf_tan_init(void) {
+  const float nyquist = 0.49f * (float)MAIN_SAMPLE_RATE;
+  for (int i = 0; i <= SVF_STEPS * SVF_OCTAVES; i++) {
+    float fc = SVF_LOW * exp2f((float)i / (float)SVF_STEPS);
+    if (fc > nyquist) fc = nyquist;
+    svf_tan[i] = tanf((float)M_PI * fc / (float)MAIN_SAMPLE_RATE);
+  }
+  svf_tan[SVF_STEPS * SVF_OCTAVES + 1] = svf_tan[SVF_STEPS * SVF_OCTAVES];
+}
+
+// the cutoff as a position in svf_tan[]
+static float svf_pitch(float f) {
+  if (!(f > SVF_LOW)) return 0.0f;
+  float p = log2f(f / SVF_LOW) * (float)SVF_STEPS;
+  return (p < SVF_TOP) ? p : SVF_TOP;
+}
+
+// The envelope is a state machine run by the audio thread: a stage, how
+// many samples into it, and the level it started from. Stage lengths and
+// their reciprocals are worked out here, so stepping it takes no divides.
+// Note on and off come from other threads as counters the audio thread
+// picks up at its next step.
+
+#define ENV_CURVE_SIZE (256)
+#define ENV_CURVE_K (5.0f)
+
+static float env_curve[ENV_CURVE_SIZE + 2];
+
+// 0 to 1 with most of the move early, like an RC charging or discharging
+static void env_curve_init(void) {
+  const float k = ENV_CURVE_K;
+  for (int i = 0; i <= ENV_CURVE_SIZE; i++) {
+    float x = (float)i / (float)ENV_CURVE_SIZE;
+    env_curve[i] = (1.0f - expf(-k * x)) / (1.0f - expf(-k));
+  }
+  env_curve[ENV_CURVE_SIZE + 1] = 1.0f;
+}
+
+static inline float env_shape(int curve, float x) {
+  if (!curve) return x;
+  float p = x * (float)ENV_CURVE_SIZE;
+  int i = (int)p;
+  float t = p - (float)i;
+  return env_curve[i] + t * (env_curve[i + 1] - env_curve[i]);
+}
+
+static int env_samples(float seconds) {
+  float n = seconds * MAIN_SAMPLE_RATE + 0.5f;
+  if (!(n > 0.0f)) return 0;
+  if (n > (float)INT32_MAX) return INT32_MAX;
+  return (int)n;
+}
+
 // Initialize the envelope
 void envelope_init(int v, float attack_time, float decay_time,
                float sustain_level, float release_time) {
-    voice_amp_envelope[v].a = attack_time;
-    voice_amp_envelope[v].d = decay_time;
-    voice_amp_envelope[v].s = sustain_level;
-    voice_amp_envelope[v].r = release_time;
-    voice_amp_envelope[v].attack_time = attack_time * MAIN_SAMPLE_RATE; // convert seconds to samples
-    voice_amp_envelope[v].decay_time = decay_time * MAIN_SAMPLE_RATE;
-    voice_amp_envelope[v].sustain_level = fmaxf(0, fminf(1.0f, sustain_level)); // clamp 0 to 1
-    voice_amp_envelope[v].release_time = release_time * MAIN_SAMPLE_RATE;
-    voice_amp_envelope[v].sample_start = 0;
-    voice_amp_envelope[v].sample_release = 0;
-    voice_amp_envelope[v].is_active = 0;
+    envelope_t *e = &voice_amp_envelope[v];
+    e->a = attack_time;
+    e->d = decay_time;
+    e->s = sustain_level;
+    e->r = release_time;
+    e->sustain_level = fmaxf(0, fminf(1.0f, sustain_level)); // clamp 0 to 1
+    const float seconds[ENV_STAGES] = { 0, attack_time, decay_time, 0, release_time };
+    for (int k = 0; k < ENV_STAGES; k++) {
+        e->length[k] = env_samples(seconds[k]);
+        e->inverse[k] = e->length[k] ? 1.0f / (float)e->length[k] : 0.0f;
+    }
+}
+
+// Only the audio thread changes the stage, a note on just bumps the gate, so
+// an envelope is running from the note on until its release has finished and
+// nothing the wire thread does can be overwritten by a release ending.
+static inline int envelope_active(envelope_t *e) {
+    return __atomic_load_n(&e->gate, __ATOMIC_ACQUIRE) != e->seen_gate || e->stage != ENV_IDLE;
 }
 
 // Trigger the envelope (note on)
 void amp_envelope_trigger(int v, float f) {
-    voice_amp_envelope[v].sample_start = synth_sample_count;
-    voice_amp_envelope[v].sample_release = 0;
     voice_amp_envelope[v].velocity = f;
-    voice_amp_envelope[v].is_active = 1;
+    __atomic_add_fetch(&voice_amp_envelope[v].gate, 1, __ATOMIC_RELEASE);
+    synth_active_touch();
 }
 
 // Release the envelope (note off)
+// (an envelope that is idle by the time the audio thread looks ignores it)
 void amp_envelope_release(int v) {
-    if (voice_amp_envelope[v].is_active) {
-        voice_amp_envelope[v].sample_release = synth_sample_count;
-    }
+    uint32_t gate = __atomic_load_n(&voice_amp_envelope[v].gate, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&voice_amp_envelope[v].release_gate, gate, __ATOMIC_RELEASE);
 }
 
-// Get the current amplitude (0 to 1) at given sample count
-float amp_envelope_step(int v) {
-    if (!voice_amp_envelope[v].is_active) return 0;
-
-    float samples_since_start = (float)(synth_sample_count - voice_amp_envelope[v].sample_start);
-
-    // Attack phase
-    if (samples_since_start < voice_amp_envelope[v].attack_time) {
-        return samples_since_start / voice_amp_envelope[v].attack_time; // linear ramp up
+// runs frames samples, out[i] gets the level after sample i (if out isn't
+// NULL), returns the level at the end
+static inline __attribute__((always_inline))
+float envelope_run(envelope_t *e, float *out, int frames) {
+    uint32_t gate = __atomic_load_n(&e->gate, __ATOMIC_ACQUIRE);
+    if (gate != e->seen_gate) {
+        e->seen_gate = gate;
+        e->stage = ENV_ATTACK;
+        e->position = 0;
+        e->from = 0.0f;
+        e->level = 0.0f;
     }
-
-    // Decay phase
-    float decay_start = voice_amp_envelope[v].attack_time;
-    if (samples_since_start < decay_start + voice_amp_envelope[v].decay_time) {
-        float samples_in_decay = samples_since_start - decay_start;
-        float decay_progress = samples_in_decay / voice_amp_envelope[v].decay_time;
-        return 1.0f - decay_progress * (1.0f - voice_amp_envelope[v].sustain_level); // linear decay to sustain
+    if (e->stage == ENV_IDLE) {
+        e->level = 0.0f;
+        if (out) memset(out, 0, frames * sizeof(float));
+        return 0.0f;
     }
-
-    // Sustain phase
-    if (voice_amp_envelope[v].sample_release == 0) {
-        return voice_amp_envelope[v].sustain_level;
+    if (__atomic_load_n(&e->release_gate, __ATOMIC_ACQUIRE) == e->seen_gate &&
+      e->stage != ENV_IDLE && e->stage != ENV_RELEASE) {
+        e->stage = ENV_RELEASE;
+        e->position = 0;
+        e->from = e->level;
     }
 
-    // Release phase
-    float samples_since_release = (float)(synth_sample_count - voice_amp_envelope[v].sample_release);
-    if (samples_since_release < voice_amp_envelope[v].release_time) {
-        float release_progress = samples_since_release / voice_amp_envelope[v].release_time;
-        return voice_amp_envelope[v].sustain_level * (1.0f - release_progress); // linear ramp down
+    const int curve = e->curve;
+    int i = 0;
+    while (i < frames) {
+        float to;
+        int next;
+        switch (e->stage) {
+            case ENV_ATTACK: to = 1.0f; next = ENV_DECAY; break;
+            case ENV_DECAY: to = e->sustain_level; next = ENV_SUSTAIN; break;
+            case ENV_RELEASE: to = 0.0f; next = ENV_IDLE; break;
+            case ENV_SUSTAIN:
+                e->level = e->sustain_level;
+                if (out) for (; i < frames; i++) out[i] = e->level;
+                return e->level;
+            default:
+                e->level = 0.0f;
+                if (out) for (; i < frames; i++) out[i] = 0.0f;
+                return 0.0f;
+        }
+        const int length = e->length[e->stage];
+        int take = length - e->position;
+        if (take < 0) take = 0; // t shortened the stage under it
+        if (take > frames - i) take = frames - i;
+        const float from = e->from;
+        const float span = to - from;
+        const float inverse = e->inverse[e->stage];
+        if (out) {
+            for (int k = 1; k <= take; k++) {
+                out[i + k - 1] = from + span * env_shape(curve, (float)(e->position + k) * inverse);
+            }
+        }
+        e->position += take;
+        i += take;
+        if (e->position >= length) {
+            e->stage = next;
+            e->position = 0;
+            e->from = to;
+            e->level = to;
+        } else {
+            e->level = from + span * env_shape(curve, (float)e->position * inverse);
+        }
     }
+    return e->level;
+}
 
-    // Envelope finished
-    voice_amp_envelope[v].is_active = 0;
-    return 0.0f;
+// Step the envelope by frames samples, returns the level (0 to 1) at the end
+float amp_envelope_step(int v, int frames) {
+    return envelope_run(&voice_amp_envelope[v], NULL, frames);
 }
 
-#include <time.h>
+// out[i] gets the level after sample i of the next frames samples
+void amp_envelope_block(int v, float *out, int frames) {
+    envelope_run(&voice_amp_envelope[v], out, frames);
+}
 
-typedef struct {
-  struct timespec a;
-  struct timespec b;
-  int64_t diff;
-  int state;
-  int order;
-  int frames;
-} sben_t;
+#include <time.h>
 
-#define BENLEN (16)
+// Only synth() writes timing, each field with a relaxed store, so other
+// threads can read it field by field without tearing and without a lock.
+// Nothing is ever reset, synth_stats() shows what changed since it last
+// looked by keeping the previous copy.
+static synth_timing_t timing = {};
+static struct timespec timing_start = {}; // of the last callback
 
-enum { BEN_0, BEN_A, BEN_B, BEN_D };
+#define TIMING_SET(field, v) do { \
+  __typeof__(field) _v = (v); \
+  __atomic_store(&(field), &_v, __ATOMIC_RELAXED); \
+} while (0)
 
-static sben_t bench[BENLEN] = {};
-static int benchp = 0;
-static int64_t bencho = 0;
+#define TIMING_GET(field, out) __atomic_load(&(field), &(out), __ATOMIC_RELAXED)
 
 int64_t ts_diff_ns(const struct timespec *a, const struct timespec *b) {
   return ((int64_t)b->tv_sec  - a->tv_sec)  * 1000000000LL +
     ((int64_t)b->tv_nsec - a->tv_nsec);
 }
 
-static char _stats[65536] = "";
+// the float's exponent and top three mantissa bits make the log buckets
+static int timing_bucket(float u) {
+  if (!(u >= 0x1p-10f)) return 0;
+  uint32_t b;
+  memcpy(&b, &u, sizeof(b));
+  int k = (int)(b >> 20) - ((127 - 10) << 3);
+  return (k < SYNTH_TIMING_BUCKETS) ? k : SYNTH_TIMING_BUCKETS - 1;
+}
+
+// the low edge of bucket k, as a share of the period
+static float timing_edge(int k) {
+  return ldexpf(1.0f + (float)(k & 7) / 8.0f, (k >> 3) - 10);
+}
+
+static void timing_update(const struct timespec *a, const struct timespec *b, int frames) {
+  const int64_t ns = ts_diff_ns(a, b);
+  const double period = (double)frames * 1e9 / (double)MAIN_SAMPLE_RATE;
+  const float u = (float)((double)ns / period);
+  const int k = timing_bucket(u);
+  TIMING_SET(timing.bucket[k], timing.bucket[k] + 1);
+  TIMING_SET(timing.ns, timing.ns + ns);
+  TIMING_SET(timing.frames, timing.frames + frames);
+  TIMING_SET(timing.last, u);
+  if (u > timing.peak) TIMING_SET(timing.peak, u);
+  if (u > 1.0f) TIMING_SET(timing.over, timing.over + 1);
+  if (timing_start.tv_sec && ts_diff_ns(&timing_start, a) > 2 * period) {
+    TIMING_SET(timing.late, timing.late + 1);
+  }
+  timing_start = *a;
+  TIMING_SET(timing.callbacks, timing.callbacks + 1);
+}
 
-#define NS_TO_MS (1000000)
-#define S_TO_MS (1000)
+void synth_timing_get(synth_timing_t *t) {
+  TIMING_GET(timing.callbacks, t->callbacks);
+  TIMING_GET(timing.over, t->over);
+  TIMING_GET(timing.late, t->late);
+  TIMING_GET(timing.ns, t->ns);
+  TIMING_GET(timing.frames, t->frames);
+  TIMING_GET(timing.last, t->last);
+  TIMING_GET(timing.peak, t->peak);
+  for (int k = 0; k < SYNTH_TIMING_BUCKETS; k++) TIMING_GET(timing.bucket[k], t->bucket[k]);
+}
+
+// the share of the period that fraction p of the callbacks got done in,
+// to the top of the bucket the p'th one is in
+static float timing_percentile(const uint64_t *bucket, uint64_t count, double p) {
+  uint64_t want = (uint64_t)ceil(p * (double)count);
+  uint64_t seen = 0;
+  if (want == 0) want = 1;
+  for (int k = 0; k < SYNTH_TIMING_BUCKETS; k++) {
+    seen += bucket[k];
+    if (seen >= want) return timing_edge(k + 1);
+  }
+  return timing_edge(SYNTH_TIMING_BUCKETS);
+}
+
+static char _stats[65536] = "";
 
 char *synth_stats(void) {
+  static synth_timing_t last = {};
+  synth_timing_t now;
+  uint64_t window[SYNTH_TIMING_BUCKETS];
+  synth_timing_get(&now);
+  for (int k = 0; k < SYNTH_TIMING_BUCKETS; k++) window[k] = now.bucket[k] - last.bucket[k];
+  const uint64_t count = now.callbacks - last.callbacks;
+  const double period = (double)synth_frames_per_callback * 1000.0 / (double)MAIN_SAMPLE_RATE;
+  const double mean = now.frames ? (double)now.ns * MAIN_SAMPLE_RATE / 1e9 / (double)now.frames : 0;
+
   char *ptr = _stats;
-  *ptr = '\0';
-  int n = 0;
-  for (int i = 0; i < BENLEN; i++) {
-    if (bench[i].state != BEN_B) continue;
-    double maxcb = (double)bench[i].frames / (double)MAIN_SAMPLE_RATE * (double)S_TO_MS;
-    double dms = ts_diff_ns(&bench[i].a, &bench[i].b) / (double)NS_TO_MS;
-    n = sprintf(ptr,
-      "# %d %d %gms %gms\n",
-      bench[i].order,
-      bench[i].frames,
-      dms,
-      maxcb);
-    ptr += n;
-    bench[i].state = BEN_0;
+  ptr += sprintf(ptr, "# synth %llu callbacks of %d frames (%gms), %llu over, %llu late, mean %.1f%% peak %.1f%%\n",
+    (unsigned long long)now.callbacks, synth_frames_per_callback, period,
+    (unsigned long long)now.over, (unsigned long long)now.late, mean * 100.0, now.peak * 100.0);
+  if (now.callbacks) {
+    float top = timing_percentile(now.bucket, now.callbacks, 0.999);
+    ptr += sprintf(ptr, "# p50 %.1f%% p99 %.1f%% p99.9 %.1f%%\n",
+      timing_percentile(now.bucket, now.callbacks, 0.5) * 100.0f,
+      timing_percentile(now.bucket, now.callbacks, 0.99) * 100.0f,
+      ((top < now.peak) ? top : now.peak) * 100.0f);
   }
+  if (count) {
+    ptr += sprintf(ptr, "# since last: %llu callbacks, %llu over, %llu late, p50 %.1f%% p99 %.1f%% p99.9 %.1f%%\n",
+      (unsigned long long)count, (unsigned long long)(now.over - last.over),
+      (unsigned long long)(now.late - last.late),
+      timing_percentile(window, count, 0.5) * 100.0f,
+      timing_percentile(window, count, 0.99) * 100.0f,
+      timing_percentile(window, count, 0.999) * 100.0f);
+    for (int k = 0; k < SYNTH_TIMING_BUCKETS; k++) {
+      if (window[k] == 0) continue;
+      ptr += sprintf(ptr, "#   %6.2f%% %10llu\n", timing_edge(k) * 100.0f, (unsigned long long)window[k]);
+    }
+  }
+  last = now;
+  ptr += synth_perf_show(ptr, (int)(sizeof(_stats) - (ptr - _stats)));
   return _stats;
 }
 
 #define BENCH_CLOCK CLOCK_MONOTONIC
-#ifdef _IS_OSX_
-#define VOICE_CLOCK CLOCK_MONOTONIC
-#else
 
-#ifdef _WIN32
-#define VOICE_CLOCK CLOCK_MONOTONIC
-#else
-#define VOICE_CLOCK CLOCK_MONOTONIC_COARSE
-#endif
+// Modulation graph
+//
+// Every voice can read another voice's output as a frequency (F), cz (C),
+// amp (A), pan (P), filter cutoff (O) or filter resonance (R) modulator. Whenever one of those connections changes,
+// synth_plan_update() turns the graph into a render order where modulators
+// always come before the voices they modulate. Voices that modulate each
+// other (a cycle, including a voice modulating itself) become one unit that
+// is rendered sample by sample in voice number order, and any edge inside
+// the unit that points at a voice not yet rendered for this sample is an
+// explicit one sample delay. The plan is built on whichever thread changed
+// the graph and handed to the audio thread through a triple buffer.
+
+enum {
+  MOD_FREQ = 1,
+  MOD_CZ = 2,
+  MOD_AMP = 4,
+  MOD_PAN = 8,
+  MOD_CUTOFF = 16,
+  MOD_RES = 32,
+};
+
+#define MOD_INPUTS (6)
 
-#endif
+typedef struct {
+  int count;                      // voices in render order
+  int *order;
+  int units;                      // unit u is order[unit_start[u]..unit_start[u+1]-1]
+  int *unit_start;                // voice_max + 1
+  int *unit_interleave;           // render sample by sample (a cycle)
+  int *delayed;                   // MOD_* inputs read from the previous sample
+  int levels;                     // units by dependency depth, only for synth_run
+  int *level_start;               // voice_max + 1
+  int *level_unit;
+} synth_plan_t;
+
+#define PLAN_FRESH (4)
+
+static synth_plan_t synth_plans[3];
+static int plan_back = 0;   // being built
+static int plan_middle = 1; // last published, PLAN_FRESH until the audio thread takes it
+static int plan_front = 2;  // used by the audio thread
+static int plan_request = 0;
+static char plan_building = 0;
+
+// the voice read by each modulation input of voice n, or -1
+static void voice_mod_sources(int n, int src[MOD_INPUTS]) {
+  int noise = wave_is_noise(voice_wave_table_index[n]);
+  int m = voice_freq_mod_osc[n];
+  src[0] = (!noise && m >= 0 && m != n) ? m : -1;
+  m = voice_cz_mod_osc[n];
+  src[1] = (!noise && voice_cz_mode[n] && m >= 0) ? m : -1;
+  src[2] = voice_amp_mod_osc[n];
+  src[3] = voice_pan_mod_osc[n];
+  src[4] = voice_cutoff_mod_osc[n];
+  src[5] = voice_res_mod_osc[n];
+}
 
-void synth_voice_bench(int voice) {
-  voice_mark_b[voice].tv_sec = 0;
-  voice_mark_b[voice].tv_nsec = 0;
-  clock_gettime(VOICE_CLOCK, &voice_mark_a[voice]);
-  voice_mark_go[voice] = 1;
+// What a voice needs from the renderer, kept in voice_features[] by the
+// setters so the audio thread picks its kernels without looking at the
+// voice's settings. The low bits index the specialized stage kernels.
+
+enum {
+  VOICE_FM = 1,          // oscillator kernels
+  VOICE_CZ = 2,
+  VOICE_ENV = 4,         // amp kernels
+  VOICE_AMP_MOD = 8,
+  VOICE_SMOOTH = 16,
+  VOICE_CONTROL = 32,    // amp and pan kernels
+  VOICE_PAN_MOD = 64,    // pan kernels
+  VOICE_NOISE = 128,     // whole stages skipped per block
+  VOICE_HOLD = 256,
+  VOICE_QUANTIZE = 512,
+  VOICE_FILTER = 1024,
+  VOICE_MUTE = 2048,
+  VOICE_FILTER_MOD = 4096, // the svf instead of the biquad
+};
+
+void voice_features_update(int v) {
+  if (v < 0 || v >= voice_max) return;
+  int src[MOD_INPUTS];
+  voice_mod_sources(v, src);
+  int f = 0;
+  if (wave_is_noise(voice_wave_table_index[v])) f |= VOICE_NOISE;
+  else if (voice_cz_mode[v]) f |= VOICE_CZ;
+  if (src[0] >= 0) f |= VOICE_FM;
+  if (voice_use_amp_envelope[v]) f |= VOICE_ENV;
+  if (src[2] >= 0) f |= VOICE_AMP_MOD;
+  if (voice_smoother_enable[v]) f |= VOICE_SMOOTH;
+  if (src[3] >= 0) f |= VOICE_PAN_MOD;
+  if (voice_sample_hold_max[v]) f |= VOICE_HOLD;
+  if (voice_quantize[v]) f |= VOICE_QUANTIZE;
+  if (voice_filter_mode[v]) f |= VOICE_FILTER;
+  if ((f & VOICE_FILTER) && (src[4] >= 0 || src[5] >= 0)) f |= VOICE_FILTER_MOD;
+  if (voice_disconnect[v]) f |= VOICE_MUTE;
+  if (voice_control[v] && synth_control_frames > 1 &&
+    (f & (VOICE_ENV | VOICE_AMP_MOD | VOICE_PAN_MOD))) f |= VOICE_CONTROL;
+  // a frequency modulated voice can't sleep, see voice_active()
+  if ((voice_features[v] ^ f) & VOICE_FM) synth_active_touch();
+  voice_features[v] = f;
 }
 
-void synth(float *buffer, float *input, int num_frames, int num_channels, void *user) {
-  static float *one_skred_frame;
-  static uint64_t synth_random;
-  static int first = 1;
-  if (first) {
-    synth_frames_per_callback = num_frames;
-    audio_rng_init(&synth_random, 1);
-    one_skred_frame = (float *)user;
-    first = 0;
+typedef struct {
+  int index;
+  int *low;
+  int *seen;
+  int *on_stack;
+  int *stack;
+  int sp;
+  int *unit_of;
+  int *pos;
+  synth_plan_t *plan;
+} plan_scratch_t;
+
+static plan_scratch_t plan_scratch;
+
+static int int_compare(const void *a, const void *b) {
+  return *(const int *)a - *(const int *)b;
+}
+
+// Tarjan's strongly connected components, which come out with every
+// component after the components it reads from
+static void plan_visit(plan_scratch_t *t, int n) {
+  t->seen[n] = t->low[n] = ++t->index;
+  t->stack[t->sp++] = n;
+  t->on_stack[n] = 1;
+  int src[MOD_INPUTS];
+  voice_mod_sources(n, src);
+  for (int k = 0; k < MOD_INPUTS; k++) {
+    int m = src[k];
+    if (m < 0 || m >= voice_max) continue;
+    if (!t->seen[m]) {
+      plan_visit(t, m);
+      if (t->low[m] < t->low[n]) t->low[n] = t->low[m];
+    } else if (t->on_stack[m] && t->seen[m] < t->low[n]) {
+      t->low[n] = t->seen[m];
+    }
+  }
+  if (t->low[n] != t->seen[n]) return;
+  synth_plan_t *plan = t->plan;
+  int u = plan->units++;
+  int start = plan->count;
+  plan->unit_start[u] = start;
+  int m;
+  do {
+    m = t->stack[--t->sp];
+    t->on_stack[m] = 0;
+    t->unit_of[m] = u;
+    plan->order[plan->count++] = m;
+  } while (m != n);
+  int len = plan->count - start;
+  qsort(&plan->order[start], len, sizeof(int), int_compare);
+  plan->unit_start[u + 1] = plan->count;
+  plan->unit_interleave[u] = (len > 1);
+  for (int i = start; i < plan->count; i++) t->pos[plan->order[i]] = i;
+}
+
+static void synth_plan_build(synth_plan_t *plan) {
+  plan_scratch_t *t = &plan_scratch;
+  t->index = 0;
+  t->sp = 0;
+  memset(t->seen, 0, voice_max * sizeof(int));
+  memset(t->on_stack, 0, voice_max * sizeof(int));
+  t->plan = plan;
+  plan->count = 0;
+  plan->units = 0;
+  plan->unit_start[0] = 0;
+  for (int n = 0; n < voice_max; n++) {
+    if (!t->seen[n]) plan_visit(t, n);
   }
-  clock_gettime(BENCH_CLOCK, &bench[benchp].a);
-  bench[benchp].frames = num_frames;
-  bench[benchp].order = bencho;
-  bench[benchp].state = BEN_A;
-  if (benchp == (BENLEN-1)) {
-    // compute min max here
-  }
-  int skred_ptr = 0;
-  for (int i = 0; i < num_frames; i++) {
-    synth_sample_count++;
-    float sample_left = 0.0f;
-    float sample_right = 0.0f;
-    float f = 0.0f;
-    float whiteish = audio_rng_float(&synth_random);
-    for (int n = 0; n < VOICE_MAX; n++) {
-      if (voice_mark_go[n]) {
-        clock_gettime(VOICE_CLOCK, &voice_mark_b[n]);
-        voice_mark_go[n] = 0;
+  for (int n = 0; n < voice_max; n++) {
+    int src[MOD_INPUTS];
+    voice_mod_sources(n, src);
+    plan->delayed[n] = 0;
+    for (int k = 0; k < MOD_INPUTS; k++) {
+      int m = src[k];
+      if (m < 0 || m >= voice_max) continue;
+      if (t->unit_of[m] == t->unit_of[n] && t->pos[m] >= t->pos[n]) {
+        plan->delayed[n] |= (1 << k);
+        plan->unit_interleave[t->unit_of[n]] = 1; // includes self modulation
       }
-      if (voice_finished[n]) {
-        voice_sample[n] = 0.0f;
-        one_skred_frame[skred_ptr++] = 0.0f;
-        one_skred_frame[skred_ptr++] = 0.0f;
-        continue;
-      }  
-      if (voice_amp[n] == 0) {
-        voice_sample[n] = 0.0f;
-        one_skred_frame[skred_ptr++] = 0.0f;
-        one_skred_frame[skred_ptr++] = 0.0f;
+    }
+  }
+}
+
+// rebuild and publish the render order, safe to call from any thread
+void synth_plan_update(void) {
+  __atomic_store_n(&plan_request, 1, __ATOMIC_RELEASE);
+  while (!__atomic_test_and_set(&plan_building, __ATOMIC_ACQUIRE)) {
+    while (__atomic_exchange_n(&plan_request, 0, __ATOMIC_ACQ_REL)) {
+      synth_plan_build(&synth_plans[plan_back]);
+      plan_back = __atomic_exchange_n(&plan_middle, plan_back | PLAN_FRESH, __ATOMIC_ACQ_REL) & ~PLAN_FRESH;
+    }
+    __atomic_clear(&plan_building, __ATOMIC_RELEASE);
+    // another thread may have asked while we were letting go
+    if (!__atomic_load_n(&plan_request, __ATOMIC_ACQUIRE)) break;
+  }
+}
+
+static synth_plan_t *synth_plan_acquire(void) {
+  if (__atomic_load_n(&plan_middle, __ATOMIC_ACQUIRE) & PLAN_FRESH) {
+    plan_front = __atomic_exchange_n(&plan_middle, plan_front, __ATOMIC_ACQ_REL) & ~PLAN_FRESH;
+  }
+  return &synth_plans[plan_front];
+}
+
+// Block renderer
+//
+// synth() cuts each callback into blocks of at most SYNTH_BLOCK_FRAMES and
+// walks the render plan. A voice on its own is rendered across the whole
+// block one stage at a time (oscillator -> hold -> quantize -> filter ->
+// envelope/amp -> pan) into voice_block[]; a cycle is rendered one sample at
+// a time. The mix is then summed in voice number order.
+
+static float synth_mix_left[SYNTH_BLOCK_FRAMES];
+static float synth_mix_right[SYNTH_BLOCK_FRAMES];
+static int *synth_live;   // samples of the block each voice contributed
+static int *synth_simple; // voices handed to the vector kernel this block
+
+// Active voices
+//
+// Only voices that can make a sound are rendered, mixed or written to the
+// stems. The list is rebuilt on the audio thread at the start of a block when
+// a setter has woken a voice up (synth_active_touch()), a voice went quiet in
+// the last block, or a new render plan arrived. Going quiet covers amp 0, a
+// finished one shot, and an envelope that has ended once its smoother has
+// settled, unless the voice is frequency modulated.
+
+#define SYNTH_SILENT (1e-6f)
+
+static int synth_active_dirty = 1;
+static int *synth_active; // voice numbers in ascending order
+static int synth_active_len = 0;
+static int *synth_idle;   // asleep on an ended envelope, their oscillators still run
+static int synth_idle_len = 0;
+static char *synth_is_active;
+static synth_plan_t synth_run;       // the render plan without the idle voices
+static synth_plan_t *synth_run_plan = NULL;
+
+// audio thread scratch
+static int *synth_scratch_unit_of;
+static int *synth_scratch_level;
+static int *synth_scratch_level_count;
+static int *synth_scratch_simple;
+static int *synth_scratch_rest;
+static int *synth_scratch_filtered;
+
+static void plan_alloc(synth_plan_t *plan) {
+  plan->order = (int *)calloc(voice_max, sizeof(int));
+  plan->unit_start = (int *)calloc(voice_max + 1, sizeof(int));
+  plan->unit_interleave = (int *)calloc(voice_max, sizeof(int));
+  plan->delayed = (int *)calloc(voice_max, sizeof(int));
+  plan->level_start = (int *)calloc(voice_max + 1, sizeof(int));
+  plan->level_unit = (int *)calloc(voice_max, sizeof(int));
+}
+
+static void plan_free(synth_plan_t *plan) {
+  free(plan->order);
+  free(plan->unit_start);
+  free(plan->unit_interleave);
+  free(plan->delayed);
+  free(plan->level_start);
+  free(plan->level_unit);
+  memset(plan, 0, sizeof(*plan));
+}
+
+// everything here is sized by voice_max, so it waits for synth_init()
+static void synth_render_init(void) {
+  for (int i = 0; i < 3; i++) plan_alloc(&synth_plans[i]);
+  plan_alloc(&synth_run);
+  plan_scratch_t *t = &plan_scratch;
+  t->low = (int *)calloc(voice_max, sizeof(int));
+  t->seen = (int *)calloc(voice_max, sizeof(int));
+  t->on_stack = (int *)calloc(voice_max, sizeof(int));
+  t->stack = (int *)calloc(voice_max, sizeof(int));
+  t->unit_of = (int *)calloc(voice_max, sizeof(int));
+  t->pos = (int *)calloc(voice_max, sizeof(int));
+  synth_live = (int *)calloc(voice_max, sizeof(int));
+  synth_simple = (int *)calloc(voice_max, sizeof(int));
+  synth_active = (int *)calloc(voice_max, sizeof(int));
+  synth_idle = (int *)calloc(voice_max, sizeof(int));
+  synth_is_active = (char *)calloc(voice_max, sizeof(char));
+  synth_scratch_unit_of = (int *)calloc(voice_max, sizeof(int));
+  synth_scratch_level = (int *)calloc(voice_max, sizeof(int));
+  synth_scratch_level_count = (int *)calloc(voice_max + 1, sizeof(int));
+  synth_scratch_simple = (int *)calloc(voice_max, sizeof(int));
+  synth_scratch_rest = (int *)calloc(voice_max, sizeof(int));
+  synth_scratch_filtered = (int *)calloc(voice_max, sizeof(int));
+  synth_run_plan = NULL;
+  synth_active_len = 0;
+  synth_active_touch();
+}
+
+static void synth_render_free(void) {
+  for (int i = 0; i < 3; i++) plan_free(&synth_plans[i]);
+  plan_free(&synth_run);
+  plan_scratch_t *t = &plan_scratch;
+  free(t->low);
+  free(t->seen);
+  free(t->on_stack);
+  free(t->stack);
+  free(t->unit_of);
+  free(t->pos);
+  free(synth_live);
+  free(synth_simple);
+  free(synth_active);
+  free(synth_idle);
+  free(synth_is_active);
+  free(synth_scratch_unit_of);
+  free(synth_scratch_level);
+  free(synth_scratch_level_count);
+  free(synth_scratch_simple);
+  free(synth_scratch_rest);
+  free(synth_scratch_filtered);
+}
+
+void synth_active_touch(void) {
+  __atomic_store_n(&synth_active_dirty, 1, __ATOMIC_RELEASE);
+}
+
+int synth_active_count(void) {
+  return __atomic_load_n(&synth_active_len, __ATOMIC_RELAXED);
+}
+
+static int voice_active(int n) {
+  if (voice_finished[n] || voice_amp[n] == 0) return 0;
+  if (voice_use_amp_envelope[n] && !envelope_active(&voice_amp_envelope[n])) {
+    // voice_skip() can't follow a phase a modulator moves, so these render
+    // their silence instead
+    if (voice_features[n] & VOICE_FM) return 1;
+    if (!voice_smoother_enable[n]) return 0;
+    if (fabsf(voice_smoother_gain[n]) < SYNTH_SILENT) return 0;
+  }
+  return 1;
+}
+
+static void synth_active_build(synth_plan_t *plan) {
+  const int first = (synth_run_plan == NULL);
+  int len = 0;
+  int idle = 0;
+  for (int n = 0; n < voice_max; n++) {
+    int active = voice_active(n);
+    if (!active && (synth_is_active[n] || first)) {
+      // modulation inputs may still read it while it sleeps
+      memset(voice_block[n], 0, sizeof(block_t));
+      voice_sample[n] = 0.0f;
+    }
+    synth_is_active[n] = active;
+    if (active) synth_active[len++] = n;
+    else if (!voice_finished[n] && voice_amp[n] != 0) synth_idle[idle++] = n;
+  }
+  synth_idle_len = idle;
+  __atomic_store_n(&synth_active_len, len, __ATOMIC_RELAXED);
+
+  synth_run.count = 0;
+  synth_run.units = 0;
+  synth_run.unit_start[0] = 0;
+  for (int u = 0; u < plan->units; u++) {
+    const int start = synth_run.count;
+    for (int k = plan->unit_start[u]; k < plan->unit_start[u + 1]; k++) {
+      int n = plan->order[k];
+      if (synth_is_active[n]) synth_run.order[synth_run.count++] = n;
+    }
+    if (synth_run.count == start) continue;
+    synth_run.unit_interleave[synth_run.units] = plan->unit_interleave[u];
+    synth_run.unit_start[++synth_run.units] = synth_run.count;
+  }
+  memcpy(synth_run.delayed, plan->delayed, voice_max * sizeof(int));
+
+  // a unit can render once every unit it reads from is done, units on the
+  // same level are independent of each other
+  int *unit_of = synth_scratch_unit_of;
+  int *level = synth_scratch_level;
+  int *level_count = synth_scratch_level_count;
+  memset(level_count, 0, (voice_max + 1) * sizeof(int));
+  synth_run.levels = 0;
+  for (int u = 0; u < synth_run.units; u++) {
+    for (int k = synth_run.unit_start[u]; k < synth_run.unit_start[u + 1]; k++) {
+      unit_of[synth_run.order[k]] = u;
+    }
+  }
+  for (int u = 0; u < synth_run.units; u++) {
+    level[u] = 0;
+    for (int k = synth_run.unit_start[u]; k < synth_run.unit_start[u + 1]; k++) {
+      int src[MOD_INPUTS];
+      voice_mod_sources(synth_run.order[k], src);
+      for (int j = 0; j < MOD_INPUTS; j++) {
+        int m = src[j];
+        if (m < 0 || m >= voice_max || !synth_is_active[m]) continue;
+        int v = unit_of[m];
+        if (v < u && level[v] + 1 > level[u]) level[u] = level[v] + 1;
+      }
+    }
+    level_count[level[u] + 1]++;
+    if (level[u] + 1 > synth_run.levels) synth_run.levels = level[u] + 1;
+  }
+  synth_run.level_start[0] = 0;
+  for (int l = 0; l < synth_run.levels; l++) {
+    synth_run.level_start[l + 1] = synth_run.level_start[l] + level_count[l + 1];
+    level_count[l + 1] = synth_run.level_start[l];
+  }
+  for (int u = 0; u < synth_run.units; u++) {
+    synth_run.level_unit[level_count[level[u] + 1]++] = u;
+  }
+
+  synth_run_plan = plan;
+}
+
+// where voice n reads modulator m from for the samples starting at start
+static inline const float *mod_source(int n, int m, int input, int delayed, int start) {
+  if (delayed & input) return &voice_sample[m]; // previous sample
+  return voice_block[m] + start;
+}
+
+// Stage kernels. Each stage is written once with the feature bits as a
+// constant and stamped out for every combination of its bits, so a voice
+// only runs the per sample work its features ask for.
+
+static inline __attribute__((always_inline))
+int osc_stage(int n, float *out, int frames, const float *fsrc, const float *csrc, float finc, const int f) {
+  const float *table = voice_table[n];
+  const int table_size = voice_table_size[n];
+  const int one_shot = voice_one_shot[n];
+  const int loop_enabled = voice_loop_enabled[n];
+  const int looped = loop_enabled && voice_loop_valid[n];
+  const phase_t loop_start = looped ? voice_loop_start_p[n] : 0;
+  const phase_t loop_end = looped ? voice_loop_end_p[n] : (phase_t)table_size << PHASE_SHIFT;
+  const phase_t loop_length = loop_end - loop_start;
+  const int stop = one_shot && !loop_enabled;
+  const int reverse = voice_direction[n];
+  const phase_t step = reverse ? -voice_phase_step[n] : voice_phase_step[n];
+  const float fdepth = voice_freq_mod_depth[n];
+  const int cz_mode = voice_cz_mode[n];
+  const float cz_distortion = voice_cz_distortion[n];
+  const float cz_scale = 1.0f / ((float)table_size * (float)PHASE_ONE);
+  const float cdepth = voice_cz_mod_depth[n];
+  if (table == NULL || loop_length <= 0) {
+    memset(out, 0, frames * sizeof(float));
+    return frames;
+  }
+  // a whole power of two table that wraps wraps by mask
+  const phase_t mask = (!looped && !stop && (table_size & (table_size - 1)) == 0) ? loop_end - 1 : 0;
+  phase_t phase = voice_phase[n];
+  int live = frames;
+  for (int i = 0; i < frames; i++) {
+    phase_t phase_inc = step;
+    if (f & VOICE_FM) {
+      float g = fsrc[i] * fdepth;
+      float d = finc * g;
+      if (!isfinite(d)) {
+        phase = 0;
+        out[i] = 0.0f;
+        if (one_shot) {
+          voice_finished[n] = 1;
+          live = i + 1;
+          break;
+        }
         continue;
       }
-      if (voice_wave_table_index[n] == WAVE_TABLE_NOISE_ALT) {
-        // bypass lots of stuff if this voice uses random source...
-        // reuse the one white noise source for each sample
-        f = whiteish;
+      phase_inc = voice_phase_step[n] + phase_from_frames(d);
+      if (reverse) phase_inc = -phase_inc;
+    }
+    phase += phase_inc;
+    int finished = 0;
+    if (mask) {
+      phase &= mask;
+    } else if (phase >= loop_end) {
+      if (stop) {
+        phase = loop_end - 1;
+        finished = 1;
       } else {
-        int mod = voice_freq_mod_osc[n];
-        if (mod >= 0 && mod != n) {
-          // try to use modulators phase_inc instead of recalculating...
-          // REQUIRES re-thinking how I'm scaling frequency modulators via wire...
-          // REVISIT experiments to see if this still makes sense
-          float g = voice_sample[mod] * voice_freq_mod_depth[n];
-          float inc = voice_phase_inc[n] + (voice_phase_inc[mod] * voice_freq_scale[n] * g);
-          f = osc_next(n, inc);
+        phase -= loop_length;
+        if (phase >= loop_end) phase = loop_start + (phase - loop_start) % loop_length;
+      }
+    } else if (phase < loop_start) {
+      if (stop) {
+        phase = loop_start;
+        finished = 1;
+      } else {
+        phase += loop_length;
+        if (phase < loop_start) phase = loop_end - 1 - (loop_start - 1 - phase) % loop_length;
+      }
+    }
+    if (f & VOICE_CZ) {
+      out[i] = (float)phase * cz_scale; // read through cz_stage() below
+    } else {
+      int idx = (int)(phase >> PHASE_SHIFT);
+      if (idx >= table_size) idx = table_size - 1;
+      if (idx < 0) idx = 0;
+      out[i] = table[idx];
+    }
+    if (finished) {
+      voice_finished[n] = 1;
+      live = i + 1;
+      break;
+    }
+  }
+  voice_phase[n] = phase;
+  // with no modulator the distortion has always been read as d + 1, which
+  // the clamp makes full distortion
+  if (f & VOICE_CZ) cz_stage(cz_mode, out, live, csrc, csrc ? cz_distortion : cz_distortion + 1.0f, cdepth, table, table_size);
+  return live;
+}
+
+static inline __attribute__((always_inline))
+void amp_stage(int n, float *out, int live, const float *asrc, const int f) {
+  const float amp = voice_amp[n];
+  const float velocity = voice_amp_envelope[n].velocity;
+  const float adepth = voice_amp_mod_depth[n];
+  if (f & VOICE_CONTROL) {
+    // the target is worked out at the end of each control step and ramped
+    // to from where the last one ended
+    const int period = synth_control_frames;
+    const float smoothing = voice_smoother_smoothing[n];
+    float gain = voice_smoother_gain[n];
+    float target = voice_control_gain[n];
+    for (int i0 = 0; i0 < live; i0 += period) {
+      const int len = (live - i0 < period) ? live - i0 : period;
+      const int i1 = i0 + len;
+      float env = (f & VOICE_ENV) ? amp_envelope_step(n, len) * velocity : 1.0f;
+      float mod = (f & VOICE_AMP_MOD) ? asrc[i1 - 1] * adepth : 1.0f;
+      const float next = amp * env * mod;
+      const float slope = (next - target) / (float)len;
+      for (int i = i0; i < i1; i++) {
+        target += slope;
+        if (f & VOICE_SMOOTH) {
+          gain += smoothing * (target - gain);
+          out[i] *= gain;
         } else {
-          f = osc_next(n, voice_phase_inc[n]);
+          out[i] *= target;
         }
       }
-      if (voice_sample_hold_max[n]) {
-        if (voice_sample_hold_count[n] == 0) {
-          voice_sample_hold[n] = f;
-        }
-        voice_sample[n] = voice_sample_hold[n];
-        voice_sample_hold_count[n]++;
-        if (voice_sample_hold_count[n] >= voice_sample_hold_max[n]) {
-          voice_sample_hold_count[n] = 0;
-        }
-      } else {
-        voice_sample[n] = f;
+      target = next;
+    }
+    voice_control_gain[n] = target;
+    if (f & VOICE_SMOOTH) voice_smoother_gain[n] = gain;
+    return;
+  }
+  float level[SYNTH_BLOCK_FRAMES];
+  if (f & VOICE_ENV) amp_envelope_block(n, level, live);
+  if (f & VOICE_SMOOTH) {
+    float gain = voice_smoother_gain[n];
+    const float smoothing = voice_smoother_smoothing[n];
+    for (int i = 0; i < live; i++) {
+      float env = (f & VOICE_ENV) ? level[i] * velocity : 1.0f;
+      float mod = (f & VOICE_AMP_MOD) ? asrc[i] * adepth : 1.0f;
+      float final = amp * env * mod;
+      gain += smoothing * (final - gain);
+      out[i] *= gain;
+    }
+    voice_smoother_gain[n] = gain;
+  } else {
+    for (int i = 0; i < live; i++) {
+      float env = (f & VOICE_ENV) ? level[i] * velocity : 1.0f;
+      float mod = (f & VOICE_AMP_MOD) ? asrc[i] * adepth : 1.0f;
+      out[i] *= amp * env * mod;
+    }
+  }
+}
+
+static inline __attribute__((always_inline))
+void pan_stage(int n, const float *out, float *left, float *right, int live, const float *psrc, const int f) {
+  if ((f & VOICE_PAN_MOD) && (f & VOICE_CONTROL)) {
+    if (live == 0) return;
+    const int period = synth_control_frames;
+    const float pdepth = voice_pan_mod_depth[n];
+    float pl = voice_pan_left[n];
+    float pr = voice_pan_right[n];
+    for (int i0 = 0; i0 < live; i0 += period) {
+      const int len = (live - i0 < period) ? live - i0 : period;
+      const int i1 = i0 + len;
+      const float q = psrc[i1 - 1] * pdepth;
+      const float next_left = (1.0f - q) / 2.0f;
+      const float next_right = (1.0f + q) / 2.0f;
+      const float step_left = (next_left - pl) / (float)len;
+      const float step_right = (next_right - pr) / (float)len;
+      for (int i = i0; i < i1; i++) {
+        pl += step_left;
+        pr += step_right;
+        left[i] = out[i] * pl;
+        right[i] = out[i] * pr;
       }
+      pl = next_left;
+      pr = next_right;
+    }
+    voice_pan_left[n] = pl;
+    voice_pan_right[n] = pr;
+  } else if (f & VOICE_PAN_MOD) {
+    if (live == 0) return;
+    const float pdepth = voice_pan_mod_depth[n];
+    float q = 0.0f;
+    for (int i = 0; i < live; i++) {
+      q = psrc[i] * pdepth;
+      left[i] = out[i] * ((1.0f - q) / 2.0f);
+      right[i] = out[i] * ((1.0f + q) / 2.0f);
+    }
+    voice_pan_left[n] = (1.0f - q) / 2.0f;
+    voice_pan_right[n] = (1.0f + q) / 2.0f;
+  } else {
+    const float pl = voice_pan_left[n];
+    const float pr = voice_pan_right[n];
+    for (int i = 0; i < live; i++) {
+      left[i] = out[i] * pl;
+      right[i] = out[i] * pr;
+    }
+  }
+}
 
-      // apply quantizer
-      if (voice_quantize[n]) voice_sample[n] = quantize_bits_int(voice_sample[n], voice_quantize[n]);
+// x, k * band and low pass mixed into each filter mode
+static const float svf_mix[FILTER_ALL_PASS + 1][3] = {
+  [FILTER_LOWPASS] = { 0.0f, 0.0f, 1.0f },
+  [FILTER_HIGHPASS] = { 1.0f, -1.0f, -1.0f },
+  [FILTER_BANDPASS] = { 0.0f, 1.0f, 0.0f },
+  [FILTER_NOTCH] = { 1.0f, -1.0f, 0.0f },
+  [FILTER_ALL_PASS] = { 1.0f, -2.0f, 0.0f },
+};
+
+// the filter of a voice with cutoff (csrc, in octaves) or resonance (rsrc)
+// modulation, either may be NULL
+static void svf_stage(int n, float *out, int live, const float *csrc, const float *rsrc) {
+  int mode = voice_filter_mode[n];
+  if (mode < FILTER_LOWPASS || mode > FILTER_ALL_PASS) mode = FILTER_LOWPASS;
+  const float mx = svf_mix[mode][0];
+  const float mb = svf_mix[mode][1];
+  const float ml = svf_mix[mode][2];
+  const float pitch = voice_filter_pitch[n];
+  const float cdepth = voice_cutoff_mod_depth[n] * (float)SVF_STEPS;
+  const float res = voice_filter_res[n];
+  const float rdepth = voice_res_mod_depth[n];
+  const float k0 = 1.0f / ((res > SVF_Q_MIN) ? res : SVF_Q_MIN);
+  float ic1 = voice_svf_ic1[n];
+  float ic2 = voice_svf_ic2[n];
+  for (int i = 0; i < live; i++) {
+    float p = csrc ? pitch + csrc[i] * cdepth : pitch;
+    if (!(p > 0.0f)) p = 0.0f;
+    if (p > SVF_TOP) p = SVF_TOP;
+    const int j = (int)p;
+    const float g = svf_tan[j] + (p - (float)j) * (svf_tan[j + 1] - svf_tan[j]);
+    float k = k0;
+    if (rsrc) {
+      float q = res + rsrc[i] * rdepth;
+      if (!(q > SVF_Q_MIN)) q = SVF_Q_MIN;
+      if (q > SVF_Q_MAX) q = SVF_Q_MAX;
+      k = 1.0f / q;
+    }
+    const float a1 = 1.0f / (1.0f + g * (g + k));
+    const float a2 = g * a1;
+    const float a3 = g * a2;
+    const float x = out[i];
+    const float v3 = x - ic2;
+    const float v1 = a1 * ic1 + a2 * v3;
+    const float v2 = ic2 + a2 * ic1 + a3 * v3;
+    ic1 = 2.0f * v1 - ic1;
+    ic2 = 2.0f * v2 - ic2;
+    out[i] = mx * x + mb * k * v1 + ml * v2;
+  }
+  voice_svf_ic1[n] = ic1;
+  voice_svf_ic2[n] = ic2;
+}
+
+typedef int (*osc_kernel_t)(int n, float *out, int frames, const float *fsrc, const float *csrc, float finc);
+typedef void (*amp_kernel_t)(int n, float *out, int live, const float *asrc);
+typedef void (*pan_kernel_t)(int n, const float *out, float *left, float *right, int live, const float *psrc);
+
+#define OSC_KERNEL(k) \
+  static int osc_kernel_##k(int n, float *out, int frames, const float *fsrc, const float *csrc, float finc) { \
+    return osc_stage(n, out, frames, fsrc, csrc, finc, k); }
+#define AMP_KERNEL(k) \
+  static void amp_kernel_##k(int n, float *out, int live, const float *asrc) { \
+    amp_stage(n, out, live, asrc, (k) << 2); }
+#define PAN_KERNEL(k) \
+  static void pan_kernel_##k(int n, const float *out, float *left, float *right, int live, const float *psrc) { \
+    pan_stage(n, out, left, right, live, psrc, (k) << 5); }
+
+OSC_KERNEL(0) OSC_KERNEL(1) OSC_KERNEL(2) OSC_KERNEL(3)
+AMP_KERNEL(0) AMP_KERNEL(1) AMP_KERNEL(2) AMP_KERNEL(3)
+AMP_KERNEL(4) AMP_KERNEL(5) AMP_KERNEL(6) AMP_KERNEL(7)
+AMP_KERNEL(8) AMP_KERNEL(9) AMP_KERNEL(10) AMP_KERNEL(11)
+AMP_KERNEL(12) AMP_KERNEL(13) AMP_KERNEL(14) AMP_KERNEL(15)
+PAN_KERNEL(0) PAN_KERNEL(1) PAN_KERNEL(2) PAN_KERNEL(3)
+
+static const osc_kernel_t osc_kernels[4] = {
+  osc_kernel_0, osc_kernel_1, osc_kernel_2, osc_kernel_3,
+};
+static const amp_kernel_t amp_kernels[16] = {
+  amp_kernel_0, amp_kernel_1, amp_kernel_2, amp_kernel_3,
+  amp_kernel_4, amp_kernel_5, amp_kernel_6, amp_kernel_7,
+  amp_kernel_8, amp_kernel_9, amp_kernel_10, amp_kernel_11,
+  amp_kernel_12, amp_kernel_13, amp_kernel_14, amp_kernel_15,
+};
+static const pan_kernel_t pan_kernels[4] = {
+  pan_kernel_0, pan_kernel_1, pan_kernel_2, pan_kernel_3,
+};
+
+// A voice block is rendered in two halves with the filter between them, so
+// filtered voices can go through synth_simd_filter() together: the source
+// (oscillator, sample and hold, quantizer) and the finish (amp, pan).
+typedef struct {
+  int f;      // features for this block
+  int src[MOD_INPUTS];
+  int live;
+} voice_pass_t;
+
+// returns 0 when the voice is silent this block, and has done all of it
+static int voice_render_source(int n, int start, int frames, int delayed, voice_pass_t *p) {
+  float *out = voice_block[n] + start;
+
+  if (voice_finished[n] || voice_amp[n] == 0) {
+    voice_sample[n] = 0.0f;
+    memset(out, 0, frames * sizeof(float));
+    return 0;
+  }
+
+  int *src = p->src;
+  voice_mod_sources(n, src);
+
+  // the features can be a block behind a setter on another thread, never
+  // hand a kernel a modulator that is not there
+  int f = voice_features[n];
+  if (src[0] < 0) f &= ~VOICE_FM;
+  if (src[2] < 0) f &= ~VOICE_AMP_MOD;
+  if (src[3] < 0) f &= ~VOICE_PAN_MOD;
+  if (src[4] < 0 && src[5] < 0) f &= ~VOICE_FILTER_MOD;
+
+  int live = frames;
+
+  // oscillator
+  if (f & VOICE_NOISE) {
+    noise_stage(n, out, frames);
+  } else {
+    const int fm = src[0];
+    const float *fsrc = (f & VOICE_FM) ? mod_source(n, fm, MOD_FREQ, delayed, start) : NULL;
+    const float *csrc = (src[1] >= 0) ? mod_source(n, src[1], MOD_CZ, delayed, start) : NULL;
+    const float finc = fsrc ? voice_phase_inc[fm] * voice_freq_scale[n] : 0.0f;
+    live = osc_kernels[f & (VOICE_FM | VOICE_CZ)](n, out, frames, fsrc, csrc, finc);
+  }
+
+  // sample and hold
+  const int hold_max = voice_sample_hold_max[n];
+  if ((f & VOICE_HOLD) && hold_max) {
+    float hold = voice_sample_hold[n];
+    int count = voice_sample_hold_count[n];
+    for (int i = 0; i < live; i++) {
+      if (count == 0) hold = out[i];
+      out[i] = hold;
+      count++;
+      if (count >= hold_max) count = 0;
+    }
+    voice_sample_hold[n] = hold;
+    voice_sample_hold_count[n] = count;
+  }
+
+  // apply quantizer
+  const int bits = voice_quantize[n];
+  if ((f & VOICE_QUANTIZE) && bits) {
+    for (int i = 0; i < live; i++) out[i] = quantize_bits_int(out[i], bits);
+  }
+
+  p->f = f;
+  p->live = live;
+  return 1;
+}
+
+// returns how many samples the voice contributed to the mix
+// (voice_block_left/right are only valid for those)
+static int voice_render_finish(int n, int start, int frames, int delayed, const voice_pass_t *p) {
+  float *out = voice_block[n] + start;
+  float *left = voice_block_left[n] + start;
+  float *right = voice_block_right[n] + start;
+  const int f = p->f;
+  const int live = p->live;
+
+  // apply amp, envelope, amp modulation and smoother
+  const float *asrc = (f & VOICE_AMP_MOD) ? mod_source(n, p->src[2], MOD_AMP, delayed, start) : NULL;
+  amp_kernels[(f >> 2) & 15](n, out, live, asrc);
+
+  // pan (read before voice_sample[] moves on, a voice may pan itself)
+  const int connected = !(f & VOICE_MUTE);
+  if (connected) {
+    const float *psrc = (f & VOICE_PAN_MOD) ? mod_source(n, p->src[3], MOD_PAN, delayed, start) : NULL;
+    pan_kernels[(f >> 5) & 3](n, out, left, right, live, psrc);
+  }
+
+  if (live < frames) {
+    memset(out + live, 0, (frames - live) * sizeof(float));
+    voice_sample[n] = 0.0f;
+  } else {
+    voice_sample[n] = out[frames - 1];
+  }
+
+  return connected ? live : 0;
+}
+
+// apply multi-mode filter, a filter that isn't modulated can go through
+// synth_simd_filter() instead
+static void voice_render_filter(int n, int start, int delayed, const voice_pass_t *p) {
+  float *out = voice_block[n] + start;
+  if (p->f & VOICE_FILTER_MOD) {
+    const float *csrc = (p->src[4] >= 0) ? mod_source(n, p->src[4], MOD_CUTOFF, delayed, start) : NULL;
+    const float *rsrc = (p->src[5] >= 0) ? mod_source(n, p->src[5], MOD_RES, delayed, start) : NULL;
+    svf_stage(n, out, p->live, csrc, rsrc);
+  } else if (p->f & VOICE_FILTER) {
+    for (int i = 0; i < p->live; i++) out[i] = mmf_process(n, out[i]);
+  }
+}
+
+// render frames samples of one voice starting at start, returns how many
+// samples it contributed to the mix (voice_block_left/right are only valid
+// for those)
+static int voice_render_block(int n, int start, int frames, int delayed) {
+  voice_pass_t p;
+  if (!voice_render_source(n, start, frames, delayed, &p)) return 0;
+  voice_render_filter(n, start, delayed, &p);
+  return voice_render_finish(n, start, frames, delayed, &p);
+}
+
+// One block's work, split into items for synth_pool_run(). Each item
+// writes only its own voices (or its own slice of the mix), so the output is
+// the same for any number of threads.
 
-      // apply multi-mode filter
-      if (voice_filter_mode[n]) voice_sample[n] = mmf_process(n, voice_sample[n]);
+#define SYNTH_MIX_SLICE (32)
+#define SYNTH_COST_EVERY (64) // blocks, about 5 a second
+#define SYNTH_COST_SMOOTHING (0.1f)
 
-      // apply amp to sample
-      float amp = voice_amp[n];
-      float env = 1.0f;
-      if (voice_use_amp_envelope[n]) env = amp_envelope_step(n) * voice_amp_envelope[n].velocity;
-      float mod = 1.0f;
-      if (voice_amp_mod_osc[n] >= 0) {
-        int m = voice_amp_mod_osc[n];
-        mod = voice_sample[m] * voice_amp_mod_depth[n];
+typedef struct {
+  const synth_plan_t *plan;
+  int frames;
+  const int *simple;  // vector kernel voices, SYNTH_SIMD_LANES per item
+  int simple_count;
+  int chunks;
+  const int *filtered; // filtered voices for the filter bank, SYNTH_SIMD_LANES per item
+  int filtered_count;
+  int banks;
+  const int *units;   // then one plan unit per item
+  int slice;          // mix frames per item
+  int offset;         // frames into the callback, for the stems
+  int cost;           // time the items into voice_cost_block[]
+} synth_job_t;
+
+static void render_unit(const synth_plan_t *plan, int u, int frames) {
+  const int first = plan->unit_start[u];
+  const int last = plan->unit_start[u + 1];
+  if (plan->unit_interleave[u]) {
+    for (int k = first; k < last; k++) synth_live[plan->order[k]] = 0;
+    for (int i = 0; i < frames; i++) {
+      for (int k = first; k < last; k++) {
+        int n = plan->order[k];
+        synth_live[n] += voice_render_block(n, i, 1, plan->delayed[n]);
       }
-      float final = amp * env * mod;
-      if (voice_smoother_enable[n]) {
-        voice_smoother_gain[n] += voice_smoother_smoothing[n] * (final - voice_smoother_gain[n]);
-        final = voice_smoother_gain[n];
+    }
+  } else {
+    int n = plan->order[first];
+    synth_live[n] = voice_render_block(n, 0, frames, 0);
+  }
+}
+
+// up to SYNTH_SIMD_LANES filtered voices that are units on their own,
+// the sources are rendered first so the filter runs across the voices
+static void render_bank(const int *voices, int count, int frames) {
+  voice_pass_t pass[SYNTH_SIMD_LANES];
+  int sounding[SYNTH_SIMD_LANES], live[SYNTH_SIMD_LANES];
+  int m = 0;
+  for (int k = 0; k < count; k++) {
+    const int n = voices[k];
+    if (voice_render_source(n, 0, frames, 0, &pass[k])) {
+      if ((pass[k].f & (VOICE_FILTER | VOICE_FILTER_MOD)) != VOICE_FILTER) {
+        voice_render_filter(n, 0, 0, &pass[k]);
+        continue;
       }
-      voice_sample[n] *= final;
-
-      if (voice_disconnect[n] == 0) {
-        // accumulate samples
-        if (voice_pan_mod_osc[n] >= 0) {
-          // handle pan modulation
-          float q = voice_sample[voice_pan_mod_osc[n]] * voice_pan_mod_depth[n];
-          voice_pan_left[n]  = (1.0f - q) / 2.0f;
-          voice_pan_right[n] = (1.0f + q) / 2.0f;
+      sounding[m] = n;
+      live[m] = pass[k].live;
+      m++;
+    } else {
+      synth_live[n] = 0;
+      pass[k].live = -1;
+    }
+  }
+  if (m) synth_simd_filter(sounding, live, m, frames);
+  for (int k = 0; k < count; k++) {
+    if (pass[k].live < 0) continue;
+    synth_live[voices[k]] = voice_render_finish(voices[k], 0, frames, 0, &pass[k]);
+  }
+}
+
+static void render_item(void *ctx, int item) {
+  const synth_job_t *job = (const synth_job_t *)ctx;
+  struct timespec a, b;
+  if (job->cost) clock_gettime(BENCH_CLOCK, &a);
+  const int *voices;
+  int count;
+  if (item < job->chunks) {
+    const int k = item * SYNTH_SIMD_LANES;
+    voices = &job->simple[k];
+    count = job->simple_count - k;
+    if (count > SYNTH_SIMD_LANES) count = SYNTH_SIMD_LANES;
+    int live[SYNTH_SIMD_LANES];
+    synth_simd_render(voices, count, job->frames, live);
+    for (int j = 0; j < count; j++) synth_live[voices[j]] = live[j];
+  } else if (item - job->chunks < job->banks) {
+    const int k = (item - job->chunks) * SYNTH_SIMD_LANES;
+    voices = &job->filtered[k];
+    count = job->filtered_count - k;
+    if (count > SYNTH_SIMD_LANES) count = SYNTH_SIMD_LANES;
+    render_bank(voices, count, job->frames);
+  } else {
+    const int u = job->units[item - job->chunks - job->banks];
+    voices = &job->plan->order[job->plan->unit_start[u]];
+    count = job->plan->unit_start[u + 1] - job->plan->unit_start[u];
+    render_unit(job->plan, u, job->frames);
+  }
+  if (job->cost) {
+    // a chunk, bank or interleaved unit is shared out evenly, every voice
+    // is in one item a block so nothing else writes these
+    clock_gettime(BENCH_CLOCK, &b);
+    const float share = (float)ts_diff_ns(&a, &b) / (float)(count * job->frames);
+    for (int k = 0; k < count; k++) voice_cost_block[voices[k]] = share;
+  }
+}
+
+int synth_cost_every = SYNTH_COST_EVERY;
+volatile uint64_t synth_cost_samples = 0;
+
+// voices that didn't render in the sampled block cost nothing and fade out
+static void synth_cost_update(void) {
+  for (int n = 0; n < voice_max; n++) {
+    voice_cost[n] += SYNTH_COST_SMOOTHING * (voice_cost_block[n] - voice_cost[n]);
+  }
+  synth_cost_samples++;
+}
+
+static void mix_item(void *ctx, int item) {
+  const synth_job_t *job = (const synth_job_t *)ctx;
+  const int i0 = item * job->slice;
+  int i1 = i0 + job->slice;
+  if (i1 > job->frames) i1 = job->frames;
+
+  // accumulate in voice order, independent of the render order
+  memset(&synth_mix_left[i0], 0, (i1 - i0) * sizeof(float));
+  memset(&synth_mix_right[i0], 0, (i1 - i0) * sizeof(float));
+  for (int k = 0; k < synth_active_len; k++) {
+    const int n = synth_active[k];
+    const int end = (synth_live[n] < i1) ? synth_live[n] : i1;
+    const float *left = voice_block_left[n];
+    const float *right = voice_block_right[n];
+    for (int i = i0; i < end; i++) {
+      synth_mix_left[i] += left[i];
+      synth_mix_right[i] += right[i];
+    }
+  }
+
+  // stems of recorded voices, synth() has already zeroed them
+  if (!synth_stem_live) return;
+  for (int k = 0; k < synth_active_len; k++) {
+    const int n = synth_active[k];
+    if (!voice_record[n]) continue;
+    const int end = (synth_live[n] < i1) ? synth_live[n] : i1;
+    if (end <= i0) continue;
+    float *left = synth_stem(n, 0) + job->offset;
+    float *right = synth_stem(n, 1) + job->offset;
+    memcpy(left + i0, voice_block_left[n] + i0, (end - i0) * sizeof(float));
+    memcpy(right + i0, voice_block_right[n] + i0, (end - i0) * sizeof(float));
+  }
+}
+
+// a voice that is just wavetable -> amp -> smoother -> pan, with a phase
+// increment small enough that one subtraction wraps it
+static int voice_is_simple(int n) {
+  if (voice_finished[n] || voice_amp[n] == 0) return 0;
+  if (voice_features[n] & ~(VOICE_SMOOTH | VOICE_MUTE)) return 0;
+  if (voice_table[n] == NULL || voice_table_size[n] <= 0) return 0;
+  const int looped = voice_loop_enabled[n] && voice_loop_valid[n];
+  const phase_t len = looped ? voice_loop_end_p[n] - voice_loop_start_p[n] : (phase_t)voice_table_size[n] << PHASE_SHIFT;
+  const phase_t step = voice_phase_step[n];
+  return (step < 0 ? -step : step) < len / 2;
+}
+
+// A voice asleep on an ended envelope was rendered, silently, before voices
+// could sleep, so its smoother keeps falling and its phase moves on as its
+// unmodulated oscillator would, and the next note starts where it always
+// did. Frequency modulated voices never sleep, voice_active() keeps them.
+static void voice_skip(int n, int frames) {
+  if (voice_smoother_enable[n]) {
+    float gain = voice_smoother_gain[n];
+    const float smoothing = voice_smoother_smoothing[n];
+    // once a step stops moving it (zero, or a denormal too small to scale) none will
+    if (gain + smoothing * (0.0f - gain) != gain) {
+      for (int i = 0; i < frames; i++) gain += smoothing * (0.0f - gain);
+      voice_smoother_gain[n] = gain;
+    }
+  }
+  if (voice_finished[n] || voice_table[n] == NULL) return;
+  const int looped = voice_loop_enabled[n] && voice_loop_valid[n];
+  const int stop = voice_one_shot[n] && !voice_loop_enabled[n];
+  const phase_t loop_start = looped ? voice_loop_start_p[n] : 0;
+  const phase_t loop_end = looped ? voice_loop_end_p[n] : (phase_t)voice_table_size[n] << PHASE_SHIFT;
+  const phase_t loop_length = loop_end - loop_start;
+  if (loop_length <= 0) return;
+  const phase_t step = voice_direction[n] ? -voice_phase_step[n] : voice_phase_step[n];
+  phase_t phase = voice_phase[n] + step * frames;
+  if (phase >= loop_end) {
+    if (stop) {
+      phase = loop_end - 1;
+      voice_finished[n] = 1;
+    } else {
+      phase = loop_start + (phase - loop_start) % loop_length;
+    }
+  } else if (phase < loop_start) {
+    if (stop) {
+      phase = loop_start;
+      voice_finished[n] = 1;
+    } else {
+      phase = loop_end - 1 - (loop_start - 1 - phase) % loop_length;
+    }
+  }
+  voice_phase[n] = phase;
+}
+
+// when the period synth() is rendering started, for latency_block()
+static uint64_t synth_period_ns = 0;
+
+static void synth_block(float *buffer, int frames, int num_channels, int offset) {
+  const uint64_t base = synth_sample_count;
+
+  latency_block(base, synth_period_ns ? synth_period_ns + (uint64_t)offset * 1000000000ULL / MAIN_SAMPLE_RATE : 0);
+
+  synth_plan_t *next = synth_plan_acquire();
+  if (__atomic_exchange_n(&synth_active_dirty, 0, __ATOMIC_ACQ_REL) || next != synth_run_plan) {
+    synth_active_build(next);
+  }
+  const synth_plan_t *plan = &synth_run;
+  for (int k = 0; k < synth_idle_len; k++) voice_skip(synth_idle[k], frames);
+
+  static unsigned cost_block = 0;
+  const int every = synth_cost_every;
+  synth_job_t job = {
+    .plan = plan,
+    .frames = frames,
+    .offset = offset,
+    .cost = (every > 0) && (cost_block++ % (unsigned)every) == 0,
+  };
+  if (job.cost) memset(voice_cost_block, 0, voice_max * sizeof(float));
+
+  // simple voices read from no one, so they go with the first level
+  const int vector = synth_simd_available();
+  int *simple = synth_scratch_simple;
+  int simple_count = 0;
+  if (vector) {
+    for (int k = 0; k < synth_active_len; k++) {
+      int n = synth_active[k];
+      synth_simple[n] = voice_is_simple(n);
+      if (synth_simple[n]) simple[simple_count++] = n;
+    }
+  }
+  job.simple = simple;
+  job.simple_count = simple_count;
+  job.chunks = (simple_count + SYNTH_SIMD_LANES - 1) / SYNTH_SIMD_LANES;
+
+  for (int l = 0; l < plan->levels; l++) {
+    const int *units = &plan->level_unit[plan->level_start[l]];
+    int count = plan->level_start[l + 1] - plan->level_start[l];
+    int *rest = synth_scratch_rest;
+    int *filtered = synth_scratch_filtered;
+    int filtered_count = 0;
+    if (vector) {
+      // filtered voices on their own go to the filter bank
+      int m = 0;
+      for (int k = 0; k < count; k++) {
+        const int u = units[k];
+        const int n = plan->order[plan->unit_start[u]];
+        if (synth_simple[n]) continue;
+        if (!plan->unit_interleave[u] && (voice_features[n] & (VOICE_FILTER | VOICE_FILTER_MOD)) == VOICE_FILTER) {
+          filtered[filtered_count++] = n;
+        } else {
+          rest[m++] = u;
         }
-        float left  = voice_sample[n] * voice_pan_left[n];
-        float right = voice_sample[n] * voice_pan_right[n];
-        sample_left  += left;
-        sample_right += right;
-        one_skred_frame[skred_ptr++] = left;
-        one_skred_frame[skred_ptr++] = right;
-      } else {
-        one_skred_frame[skred_ptr++] = 0.0f;
-        one_skred_frame[skred_ptr++] = 0.0f;
       }
+      units = rest;
+      count = m;
     }
+    job.units = units;
+    job.filtered = filtered;
+    job.filtered_count = filtered_count;
+    job.banks = (filtered_count + SYNTH_SIMD_LANES - 1) / SYNTH_SIMD_LANES;
+    synth_pool_run(render_item, &job, job.chunks + job.banks + count);
+    job.chunks = 0;
+    simple_count = 0;
+  }
+  if (job.cost) synth_cost_update();
 
+  // anything that went quiet leaves the list before the next block
+  for (int k = 0; k < synth_active_len; k++) {
+    if (!voice_active(synth_active[k])) {
+      synth_active_touch();
+      break;
+    }
+  }
+
+  job.slice = (synth_pool_threads() > 1) ? SYNTH_MIX_SLICE : frames;
+  synth_pool_run(mix_item, &job, (frames + job.slice - 1) / job.slice);
+
+  for (int i = 0; i < frames; i++) {
     // Adjust to main volume: smooth it otherwise is sounds crummy with realtime changes
     volume_smoother_gain += volume_smoother_smoothing * (volume_final - volume_smoother_gain);
     float volume_adjusted = volume_smoother_gain;
 
-    sample_left  *= volume_adjusted;
-    sample_right *= volume_adjusted;
-
     // Write to all channels
-    buffer[i * num_channels + 0] = sample_left;
-    buffer[i * num_channels + 1] = sample_right;
+    buffer[i * num_channels + 0] = synth_mix_left[i] * volume_adjusted;
+    buffer[i * num_channels + 1] = synth_mix_right[i] * volume_adjusted;
+  }
+
+  synth_sample_count = base + frames;
+}
+
+void synth(float *buffer, float *input, int num_frames, int num_channels, void *user) {
+  static int first = 1;
+  struct timespec a, b;
+  clock_gettime(BENCH_CLOCK, &a);
+  synth_perf_callback();
+  synth_period_ns = latency_enabled() ? latency_now() : 0;
+  if (first) {
+    synth_frames_per_callback = num_frames;
+    first = 0;
+  }
+  // the stems are sized before the device starts, a longer period than
+  // that goes without them (and rec_block() counts it as dropped) rather
+  // than allocating here
+  synth_stem_live = (synth_stem_buffer != NULL && num_frames <= synth_stem_frames);
+  if (synth_stem_buffer && !synth_stem_live) {
+    static int warned = 0;
+    if (!warned) printf("# period %d longer than the stems' %d, not kept\n", num_frames, synth_stem_frames);
+    warned = 1;
+  }
+  if (synth_stem_live) {
+    for (int n = 0; n < voice_max; n++) {
+      if (!voice_record[n]) continue;
+      memset(synth_stem(n, 0), 0, num_frames * sizeof(float));
+      memset(synth_stem(n, 1), 0, num_frames * sizeof(float));
+    }
   }
-  clock_gettime(BENCH_CLOCK, &bench[benchp].b);
-  bench[benchp].state = BEN_B;
-  bencho++;
-  benchp = ((bencho) % BENLEN);
+  for (int i = 0; i < num_frames; i += SYNTH_BLOCK_FRAMES) {
+    int frames = num_frames - i;
+    if (frames > SYNTH_BLOCK_FRAMES) frames = SYNTH_BLOCK_FRAMES;
+    synth_block(buffer + i * num_channels, frames, num_channels, i);
+  }
+  clock_gettime(BENCH_CLOCK, &b);
+  timing_update(&a, &b, num_frames);
 }
 
 int envelope_is_flat(int v) {
@@ -637,28 +1960,35 @@ int envelope_is_flat(int v) {
   return 0;
 }
 
+#include <stdio.h>
+
+// maybe these should be in wire.[ch]?
+
+static int voice_invalid(int voice) {
+  if (voice < 0 || voice >= voice_max) return 1;
+  return 0;
+}
+
+#define SYNTH_INVALID_VOICE (100)
+
 int cz_set(int v, int n, float f) {
+  int changed = (voice_cz_mode[v] == 0) != (n == 0);
   voice_cz_mode[v] = n;
   voice_cz_distortion[v] = f;
+  voice_features_update(v);
+  if (changed) synth_plan_update();
   return 0;
 }
 
 int cmod_set(int voice, int o, float f) {
+  if (voice_invalid(voice) || voice_invalid(o)) return SYNTH_INVALID_VOICE;
   voice_cz_mod_osc[voice] = o;
   voice_cz_mod_depth[voice] = f;
+  voice_features_update(voice);
+  synth_plan_update();
   return 0;
 }
 
-#include <stdio.h>
-
-// maybe these should be in wire.[ch]?
-
-static int voice_invalid(int voice) {
-  if (voice < 0 || voice >= VOICE_MAX) return 1;
-  return 0;
-}
-
-#define SYNTH_INVALID_VOICE (100)
 
 char *voice_format(int v, char *out, int verbose) {
   if (out == NULL) return "(NULL)";
@@ -744,6 +2074,14 @@ char *voice_format(int v, char *out, int verbose) {
     n = sprintf(ptr, " P%d,%g", voice_pan_mod_osc[v], voice_pan_mod_depth[v]);
     ptr += n;
   }
+  if (verbose || voice_cutoff_mod_osc[v] >= 0) {
+    n = sprintf(ptr, " O%d,%g", voice_cutoff_mod_osc[v], voice_cutoff_mod_depth[v]);
+    ptr += n;
+  }
+  if (verbose || voice_res_mod_osc[v] >= 0) {
+    n = sprintf(ptr, " R%d,%g", voice_res_mod_osc[v], voice_res_mod_depth[v]);
+    ptr += n;
+  }
   if (verbose || voice_disconnect[v]) {
     n = sprintf(ptr, " m%d", voice_disconnect[v]);
     ptr += n;
@@ -752,6 +2090,10 @@ char *voice_format(int v, char *out, int verbose) {
     n = sprintf(ptr, " r%d", voice_record[v]);
     ptr += n;
   }
+  if (verbose || voice_control[v] != synth_control_default) {
+    n = sprintf(ptr, " k%d", voice_control[v]);
+    ptr += n;
+  }
   if (verbose || voice_smoother_enable[v]) {
     if (voice_smoother_smoothing[v] != SMOOTH_DEFAULT) {
       n = sprintf(ptr, " s%g", voice_smoother_smoothing[v]);
@@ -769,6 +2111,10 @@ char *voice_format(int v, char *out, int verbose) {
       voice_amp_envelope[v].s,
       voice_amp_envelope[v].r);
     ptr += n;
+    if (verbose || voice_amp_envelope[v].curve) {
+      n = sprintf(ptr, ",%d", voice_amp_envelope[v].curve);
+      ptr += n;
+    }
   }
   if (verbose) {
     n = sprintf(ptr, "\n#");
@@ -793,31 +2139,33 @@ char *voice_format(int v, char *out, int verbose) {
     ptr += n;
   }
   if (verbose) {
-    n = sprintf(ptr, " phase:%g phase_inc:%g", voice_phase[v], voice_phase_inc[v]);
+    n = sprintf(ptr, " phase:%g phase_inc:%g", phase_to_frames(voice_phase[v]), voice_phase_inc[v]);
     ptr += n;
   }
   if (verbose) {
     n = sprintf(ptr, " offset_hz:%g", voice_offset_hz[v]);
     ptr += n;
   }
-  if (verbose) {
-    n = sprintf(ptr, " latency:%gms", (double)ts_diff_ns(&voice_mark_a[v], &voice_mark_b[v])/1000000.0);
-    ptr += n;
-  }
   return out;
 }
 
 
 void voice_show(int v, char c, int verbose) {
   char s[1024];
-  char e[8] = "";
-  if (c != ' ') sprintf(e, " # *");
+  char e[64] = "";
+  // the share of one core this voice takes, when it is being measured
+  const float cost = voice_cost[v] * (float)MAIN_SAMPLE_RATE / 1e7f;
+  if (synth_cost_every > 0 && cost > 0) {
+    sprintf(e, " # %.3g%%%s", cost, (c != ' ') ? " *" : "");
+  } else if (c != ' ') {
+    sprintf(e, " # *");
+  }
   voice_format(v, s, verbose);
   if (strlen(s)) printf("; %s%s\n", s, e);
 }
 
 int voice_show_all(int voice, int verbose) {
-  for (int i=0; i<VOICE_MAX; i++) {
+  for (int i=0; i<voice_max; i++) {
     if (voice_amp[i] == 0) continue;
     char t = ' ';
     if (i == voice) t = '*';
@@ -831,6 +2179,8 @@ int amp_set(int voice, float f) {
     voice_use_amp_envelope[voice] = 0;
     voice_amp[voice] = f;
     voice_user_amp[voice] = f;
+    voice_features_update(voice);
+    synth_active_touch();
   } else return 100; // <--- LAZY!! ... ERR_AMPLITUDE_OUT_OF_RANGE;
   return 0;
 }
@@ -848,6 +2198,7 @@ int pan_set(int voice, float f) {
 
 int wave_quant(int voice, int n) {
   voice_quantize[voice] = n;
+  voice_features_update(voice);
   return 0;
 }
 
@@ -867,6 +2218,19 @@ int wave_mute(int voice, int state) {
     else state = 0;
   }
   voice_disconnect[voice] = state;
+  voice_features_update(voice);
+  return 0;
+}
+
+// 1 works out envelopes, amp modulation and pan modulation once per
+// synth_control_frames and ramps between, 0 keeps them at audio rate
+int control_rate_set(int voice, int state) {
+  if (state < 0) {
+    if (voice_control[voice] == 0) state = 1;
+    else state = 0;
+  }
+  voice_control[voice] = state;
+  voice_features_update(voice);
   return 0;
 }
 
@@ -883,12 +2247,15 @@ int pan_mod_set(int voice, int o, float f) {
   if (voice_invalid(voice) || voice_invalid(o)) return SYNTH_INVALID_VOICE;
   voice_pan_mod_osc[voice] = o;
   voice_pan_mod_depth[voice] = f;
+  voice_features_update(voice);
+  synth_plan_update();
   return 0;
 }
 
 int wave_set(int voice, int wave) {
   if (wave >= 0 && wave < WAVE_TABLE_MAX) {
     osc_set_wave_table_index(voice, wave);
+    synth_plan_update(); // noise-alt ignores F and C
     // AUGGGHHHH... i love the scope, but this needs fixing in a better way...
     // if (scope_enable) scope_wave_update(voice_table[voice], voice_table_size[voice]);
   } else return 100; // <-- more LAZY!!! ERR_INVALID_WAVE;
@@ -899,6 +2266,28 @@ int amp_mod_set(int voice, int o, float f) {
   if (voice_invalid(voice) || voice_invalid(o)) return SYNTH_INVALID_VOICE;
   voice_amp_mod_osc[voice] = o;
   voice_amp_mod_depth[voice] = f;
+  voice_features_update(voice);
+  synth_plan_update();
+  return 0;
+}
+
+// filter cutoff modulation, depth in octaves, a voice of -1 disconnects
+int cutoff_mod_set(int voice, int o, float f) {
+  if (voice_invalid(voice) || (o != -1 && voice_invalid(o))) return SYNTH_INVALID_VOICE;
+  voice_cutoff_mod_osc[voice] = o;
+  voice_cutoff_mod_depth[voice] = f;
+  voice_features_update(voice);
+  synth_plan_update();
+  return 0;
+}
+
+// filter resonance modulation, depth in Q, a voice of -1 disconnects
+int res_mod_set(int voice, int o, float f) {
+  if (voice_invalid(voice) || (o != -1 && voice_invalid(o))) return SYNTH_INVALID_VOICE;
+  voice_res_mod_osc[voice] = o;
+  voice_res_mod_depth[voice] = f;
+  voice_features_update(voice);
+  synth_plan_update();
   return 0;
 }
 
@@ -907,6 +2296,8 @@ int freq_mod_set(int voice, int o, float f) {
   voice_freq_mod_osc[voice] = o;
   voice_freq_mod_depth[voice] = f;
   voice_freq_scale[voice] = (float)voice_table_size[voice] / (float)voice_table_size[o];
+  voice_features_update(voice);
+  synth_plan_update();
   return 0;
 }
 
@@ -925,6 +2316,13 @@ int envelope_set(int voice, float a, float d, float s, float r) {
   return 0;
 }
 
+// 0 is straight line segments, 1 exponential
+int envelope_curve(int voice, int curve) {
+  if (voice_invalid(voice)) return SYNTH_INVALID_VOICE;
+  voice_amp_envelope[voice].curve = (curve != 0);
+  return 0;
+}
+
 // Set parameters - only recalculates coefficients if values changed
 void mmf_set_params(int n, float f, float resonance) {
     // Only recalculate if parameters changed
@@ -997,14 +2395,15 @@ void mmf_set_params(int n, float f, float resonance) {
     }
 
     // Normalize coefficients
-    voice_filter[n].b0 = b0 / a0;
-    voice_filter[n].b1 = b1 / a0;
-    voice_filter[n].b2 = b2 / a0;
-    voice_filter[n].a1 = a1 / a0;
-    voice_filter[n].a2 = a2 / a0;
+    voice_filter_b0[n] = b0 / a0;
+    voice_filter_b1[n] = b1 / a0;
+    voice_filter_b2[n] = b2 / a0;
+    voice_filter_a1[n] = a1 / a0;
+    voice_filter_a2[n] = a2 / a0;
 
     voice_filter_freq[n] = f;
     voice_filter_res[n] = resonance;
+    voice_filter_pitch[n] = svf_pitch(f);
 }
 
 
@@ -1013,9 +2412,9 @@ void mmf_set_params(int n, float f, float resonance) {
 // resonance: resonance factor (0.1 to 10.0, where 0.707 is no resonance)
 // sample_rate: audio sample rate in Hz
 void mmf_init(int n, float f, float resonance) {
-    // Clear delay lines
-    voice_filter[n].x1 = voice_filter[n].x2 = 0.0f;
-    voice_filter[n].y1 = voice_filter[n].y2 = 0.0f;
+    // Clear state
+    voice_filter_s1[n] = voice_filter_s2[n] = 0.0f;
+    voice_svf_ic1[n] = voice_svf_ic2[n] = 0.0f;
 
     // Store parameters
     voice_filter[n].last_freq = -1.0f;  // Force coefficient calculation
@@ -1045,10 +2444,21 @@ int voice_copy(int v, int n) {
   voice_sample_hold_count[n] = voice_sample_hold_count[v];
   voice_sample_hold[n] = voice_sample_hold[v];
   envelope_set(n, voice_amp_envelope[v].a, voice_amp_envelope[v].d, voice_amp_envelope[v].s, voice_amp_envelope[v].r);
+  envelope_curve(n, voice_amp_envelope[v].curve);
   cz_set(n, voice_cz_mode[v], voice_cz_distortion[v]);
   cmod_set(n, voice_cz_mod_osc[v], voice_cz_mod_depth[v]);
   voice_filter_mode[n] = voice_filter_mode[v];
   mmf_init(n, voice_filter_freq[v], voice_filter_res[v]);
+  voice_filter_pitch[n] = voice_filter_pitch[v];
+  cutoff_mod_set(n, voice_cutoff_mod_osc[v], voice_cutoff_mod_depth[v]);
+  res_mod_set(n, voice_res_mod_osc[v], voice_res_mod_depth[v]);
+  // the filter carries on from the source's, biquad or svf
+  voice_filter_s1[n] = voice_filter_s1[v];
+  voice_filter_s2[n] = voice_filter_s2[v];
+  voice_svf_ic1[n] = voice_svf_ic1[v];
+  voice_svf_ic2[n] = voice_svf_ic2[v];
+  voice_control[n] = voice_control[v];
+  voice_features_update(n);
   // TODO stuff is missing from here...
   return 0;
 }
@@ -1104,10 +2514,16 @@ void voice_reset(int i) {
   voice_freq_mod_depth[i] = 0.0f;
   voice_freq_scale[i] = 1.0f;
   voice_pan_mod_osc[i] = -1;
+  voice_cutoff_mod_osc[i] = -1;
+  voice_cutoff_mod_depth[i] = 0.0f;
+  voice_res_mod_osc[i] = -1;
+  voice_res_mod_depth[i] = 0.0f;
+  noise_seed(i);
   voice_disconnect[i] = 0;
   voice_quantize[i] = 0;
   voice_direction[i] = 0;
   envelope_init(i, 0.0f, 0.0f, 1.0f, 0.0f);
+  voice_amp_envelope[i].curve = 0;
   voice_freq[i] = 440.0f;
   voice_midi_note[i] = 69.0f;
   voice_midi_transpose[i] = 0;
@@ -1129,17 +2545,24 @@ void voice_reset(int i) {
   voice_glissando_target[i] = voice_freq[i];
 
   voice_record[i] = 0;
+  voice_control[i] = synth_control_default;
+  voice_control_gain[i] = 0.0f;
+  voice_features_update(i);
 }
 
 void voice_init(void) {
-  for (int i=0; i<VOICE_MAX; i++) {
+  for (int i=0; i<voice_max; i++) {
     voice_reset(i);
   }
+  synth_plan_update();
 }
 
 int wave_reset(int voice, int n) {
   if (voice_invalid(n)) voice_init();
-  else voice_reset(n);
+  else {
+    voice_reset(n);
+    synth_plan_update();
+  }
   return 0;
 }
 
@@ -1149,6 +2572,7 @@ int envelope_velocity(int voice, float f) {
     amp_envelope_release(voice);
   } else {
     voice_use_amp_envelope[voice] = 1;
+    voice_features_update(voice);
     if (voice_one_shot[voice]) {
       osc_trigger(voice);
     }
@@ -1207,7 +2631,7 @@ void wave_table_init(void) {
 
   uint64_t white_noise;
   audio_rng_init(&white_noise, 1);
-  for (int w = WAVE_TABLE_SINE; w <= WAVE_TABLE_NOISE_ALT; w++) {
+  for (int w = WAVE_TABLE_SINE; w <= WAVE_TABLE_NOISE_BROWN; w++) {
     int size = SIZE_SINE;
     char *name = "?";
     switch (w) {
@@ -1217,7 +2641,9 @@ void wave_table_init(void) {
       case WAVE_TABLE_SAW_UP: name = "saw-up"; break;
       case WAVE_TABLE_TRI:   name = "triangle"; break;
       case WAVE_TABLE_NOISE: name = "noise"; break;
-      case WAVE_TABLE_NOISE_ALT: name = "noise-alt"; break; // not used, here for laziness in experiment
+      case WAVE_TABLE_NOISE_ALT: name = "noise-alt"; break; // not read, the voices generate their own
+      case WAVE_TABLE_NOISE_PINK: name = "noise-pink"; break;
+      case WAVE_TABLE_NOISE_BROWN: name = "noise-brown"; break;
       default: name = "?"; break;
     }
     printf("# make w%d %s\n", w, name);
@@ -1240,12 +2666,16 @@ void wave_table_init(void) {
         case WAVE_TABLE_SAW_UP: f = 1.0f - 2.0f * phase; break;
         case WAVE_TABLE_TRI: f = (phase < 0.5f) ? (4.0f * phase - 1.0f) : (3.0f - 4.0f * phase); break;
         case WAVE_TABLE_NOISE: f = audio_rng_float(&white_noise); break;
-        case WAVE_TABLE_NOISE_ALT: f = audio_rng_float(&white_noise); break;
+        case WAVE_TABLE_NOISE_ALT:
+        case WAVE_TABLE_NOISE_PINK:
+        case WAVE_TABLE_NOISE_BROWN: f = audio_rng_float(&white_noise); break;
         default: f = 0; break;
       }
       wave_table_data[w][off++] = f;
       phase += delta;
     }
+    noise_t colour = {};
+    noise_colour(&colour, w, wave_table_data[w], off);
   }
 
   printf("# load retro waves (%d to %d)\n", WAVE_TABLE_KRG1, WAVE_TABLE_KRG32-1);
@@ -1,16 +1,25 @@
 #ifndef _SYNTH_H_
 #define _SYNTH_H_
 
-#define ARRAY(type, name, size, init) extern type name[size];
+#define ARRAY(type, name, size, init, heat) extern type *name;
 #include "synth.def"
 #undef ARRAY
 
 void synth(float *buffer, float *input, int num_frames, int num_channels, void *user);
 void synth_init(void);
+extern int synth_arena_split;
 void synth_free(void);
 
+// per voice stems of the last callback, planar, for voices with
+// voice_record[] set, synth_stem_frames samples per channel
+int synth_stem_init(int frames);
+float *synth_stem(int voice, int channel);
+extern int synth_stem_frames;
+
 extern int requested_synth_frames_per_callback;
 extern int synth_frames_per_callback;
+extern int synth_control_frames;
+extern int synth_control_default;
 
 extern volatile uint64_t synth_sample_count;
 
@@ -27,7 +36,7 @@ float audio_rng_float(uint64_t *rng);
 float osc_get_phase_inc(int v, float f);
 void osc_set_freq(int v, float f);
 float cz_phasor(int n, float p, float d, int table_size);
-float osc_next(int voice, float phase_inc);
+extern cz_curve_t cz_curve[2];
 void osc_set_wave_table_index(int voice, int wave);
 void osc_trigger(int voice);
 float quantize_bits_int(float v, int bits);
@@ -40,12 +49,18 @@ void envelope_init(int v, float attack_time, float decay_time,
                float sustain_level, float release_time);
 void amp_envelope_trigger(int v, float f);
 void amp_envelope_release(int v);
-float amp_envelope_step(int v);
+float amp_envelope_step(int v, int frames);
+void amp_envelope_block(int v, float *out, int frames);
 
 int volume_set(float v);
 
 int envelope_is_flat(int v);
 
+void synth_plan_update(void);
+void voice_features_update(int v);
+void synth_active_touch(void);
+int synth_active_count(void);
+
 int cz_set(int v, int n, float f);
 int cmod_set(int voice, int o, float f);
 
@@ -58,13 +73,17 @@ int voice_copy(int v, int n);
 int wave_set(int voice, int wave);
 int wave_mute(int voice, int state);
 int wave_dir(int voice, int state);
+int control_rate_set(int voice, int state);
 int freq_midi(int voice, float f);
 int amp_mod_set(int voice, int o, float f);
 int envelope_velocity(int voice, float f);
 int envelope_set(int voice, float a, float d, float s, float r);
+int envelope_curve(int voice, int curve);
 int wave_reset(int voice, int n);
 int freq_mod_set(int voice, int o, float f);
 int pan_mod_set(int voice, int o, float f);
+int cutoff_mod_set(int voice, int o, float f);
+int res_mod_set(int voice, int o, float f);
 
 char *voice_format(int v, char *out, int verbose);
 void voice_show(int v, char c, int verbose);
@@ -82,6 +101,8 @@ void wave_free(void);
 void voice_init(void);
 
 char *synth_stats(void);
-void synth_voice_bench(int voice);
+extern int synth_cost_every;                 // blocks between voice_cost[] measurements, 0 for none
+extern volatile uint64_t synth_cost_samples; // measurements so far
+void synth_timing_get(synth_timing_t *t);
 
 #endif
@@ -0,0 +1,146 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "timeline.h"
+#include "util.h"
+
+// A ring is reserved with its name and only gets its events when tracing
+// is first turned on, or straight away if it already is, both away from the
+// audio thread. Its owner takes it by index, so recording is a clock read
+// and a few stores with nothing shared between threads. timeline_save()
+// reads the rings from whichever thread asks and, like the master capture,
+// drops anything the owner may have written over while it was copied.
+
+#define TIMELINE_SLACK (1024) // events an owner might write during a copy
+
+typedef struct {
+  uint64_t start;
+  uint32_t dur;
+  uint16_t kind;
+  int32_t arg;
+} timeline_event_t;
+
+typedef struct {
+  timeline_event_t *event;   // NULL until tracing is turned on
+  uint64_t head;             // events in, written by the owner
+  char name[24];
+} timeline_ring_t;
+
+static timeline_ring_t timeline_ring[TIMELINE_THREADS];
+static int timeline_count = 0; // rings reserved
+static volatile int timeline_on = 0;
+static pthread_mutex_t timeline_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread timeline_ring_t *timeline_mine = NULL;
+
+static const char *timeline_kind[TIMELINE_KINDS] = {
+  "synth callback", "queued event", "pattern step", "udp datagram", "wire",
+};
+
+uint64_t timeline_now(void) {
+  return util_now();
+}
+
+uint64_t timeline_start(void) {
+  return timeline_enabled() ? timeline_now() : 0;
+}
+
+// under timeline_lock
+static void timeline_alloc(timeline_ring_t *r) {
+  if (r->event) return;
+  timeline_event_t *event = (timeline_event_t *)calloc(TIMELINE_EVENTS, sizeof(timeline_event_t));
+  if (event == NULL) {
+    printf("# no memory for the %s timeline\n", r->name);
+    return;
+  }
+  __atomic_store_n(&r->event, event, __ATOMIC_RELEASE);
+}
+
+void timeline_enable(int on) {
+  pthread_mutex_lock(&timeline_lock);
+  if (on) {
+    for (int k = 0; k < timeline_count; k++) timeline_alloc(&timeline_ring[k]);
+  }
+  __atomic_store_n(&timeline_on, on ? 1 : 0, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&timeline_lock);
+}
+
+int timeline_enabled(void) {
+  return __atomic_load_n(&timeline_on, __ATOMIC_ACQUIRE);
+}
+
+int timeline_reserve(const char *name) {
+  pthread_mutex_lock(&timeline_lock);
+  if (timeline_count >= TIMELINE_THREADS) {
+    pthread_mutex_unlock(&timeline_lock);
+    return -1;
+  }
+  const int k = timeline_count;
+  timeline_ring_t *r = &timeline_ring[k];
+  snprintf(r->name, sizeof(r->name), "%s", name);
+  r->head = 0;
+  if (timeline_on) timeline_alloc(r);
+  __atomic_store_n(&timeline_count, k + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&timeline_lock);
+  return k;
+}
+
+void timeline_thread(int ring) {
+  timeline_mine = (ring >= 0 && ring < TIMELINE_THREADS) ? &timeline_ring[ring] : NULL;
+}
+
+void timeline_span(int kind, uint64_t start, int arg) {
+  timeline_ring_t *r = timeline_mine;
+  if (r == NULL || start == 0 || !timeline_enabled()) return;
+  timeline_event_t *event = __atomic_load_n(&r->event, __ATOMIC_ACQUIRE);
+  if (event == NULL) return;
+  const uint64_t end = timeline_now();
+  timeline_event_t *e = &event[r->head & (TIMELINE_EVENTS - 1)];
+  e->start = start;
+  e->dur = (end - start > 0xffffffffULL) ? 0xffffffffU : (uint32_t)(end - start);
+  e->kind = (uint16_t)kind;
+  e->arg = arg;
+  __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+long timeline_save(const char *name) {
+  FILE *file = fopen(name, "w");
+  if (file == NULL) return -1;
+  timeline_event_t *copy = (timeline_event_t *)malloc(TIMELINE_EVENTS * sizeof(timeline_event_t));
+  if (copy == NULL) {
+    fclose(file);
+    return -1;
+  }
+  const int pid = (int)getpid();
+  long written = 0;
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"skred\"}}", pid);
+  const int count = __atomic_load_n(&timeline_count, __ATOMIC_ACQUIRE);
+  for (int k = 0; k < count; k++) {
+    timeline_ring_t *r = &timeline_ring[k];
+    const timeline_event_t *event = __atomic_load_n(&r->event, __ATOMIC_ACQUIRE);
+    if (event == NULL) continue;
+    fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+      pid, k + 1, r->name);
+    const uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    const uint64_t held = TIMELINE_EVENTS - TIMELINE_SLACK;
+    uint64_t from = (head > held) ? head - held : 0;
+    for (uint64_t i = from; i < head; i++) copy[i - from] = event[i & (TIMELINE_EVENTS - 1)];
+    const uint64_t now = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    const uint64_t oldest = (now > held) ? now - held : 0;
+    for (uint64_t i = (from > oldest) ? from : oldest; i < head; i++) {
+      const timeline_event_t *e = &copy[i - from];
+      if (e->kind >= TIMELINE_KINDS) continue;
+      fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"n\":%d}}",
+        timeline_kind[e->kind], pid, k + 1, (double)e->start / 1000.0, (double)e->dur / 1000.0, e->arg);
+      written++;
+    }
+  }
+  fprintf(file, "\n]}\n");
+  free(copy);
+  if (fclose(file) != 0) return -1;
+  return written;
+}
@@ -0,0 +1,40 @@
+#ifndef _TIMELINE_H_
+#define _TIMELINE_H_
+
+#include <stdint.h>
+
+// Spans of what each thread was doing, kept in a ring per thread and
+// written out on demand as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+//
+//   uint64_t t = timeline_start();
+//   ... work ...
+//   timeline_span(TIMELINE_WIRE, t, length);
+//
+// A thread only records once it has a ring: timeline_reserve() names one
+// (from any thread but the audio one, it may allocate) and the thread it is
+// for takes it with timeline_thread(). Off by default; timeline_enable()
+// allocates the rings reserved so far, and while off timeline_start() is
+// one load and timeline_span() returns straight away.
+
+enum {
+  TIMELINE_CALLBACK, // the synth callback, arg is frames
+  TIMELINE_QUEUE,    // a queued event run by seq(), arg is its slot
+  TIMELINE_STEP,     // a pattern step fired by seq(), arg is the pattern
+  TIMELINE_UDP,      // a datagram, arg is its length
+  TIMELINE_WIRE,     // wire() parsing a line, arg is its length
+  TIMELINE_KINDS
+};
+
+#define TIMELINE_EVENTS (1 << 15) // per thread
+#define TIMELINE_THREADS (16)
+
+void timeline_enable(int on);
+int timeline_enabled(void);
+int timeline_reserve(const char *name);       // a ring for a thread, -1 if none left
+void timeline_thread(int ring);                // the calling thread records to ring
+uint64_t timeline_now(void);                   // ns
+uint64_t timeline_start(void);                 // now, 0 while off
+void timeline_span(int kind, uint64_t start, int arg); // from start to now
+long timeline_save(const char *name);          // events written, -1 on error
+
+#endif
@@ -20,6 +20,8 @@ typedef int socklen_t;
 #include "skred.h"
 #include "wire.h"
 #include "udp.h"
+#include "timeline.h"
+#include "latency.h"
 #include "util.h"
 
 // Simple hash function for UDP address/port to array index
@@ -76,7 +78,7 @@ typedef struct {
   int last_use;
 } udp_state_t;
 
-#define UDP_PORT_MAX (127)
+static int udp_timeline = -1; // kept across restarts
 
 static void *udp_main(void *arg) {
   if (udp_port <= 0) {
@@ -88,6 +90,8 @@ static void *udp_main(void *arg) {
     return NULL;
   }
   util_set_thread_name("udp");
+  if (udp_timeline < 0) udp_timeline = timeline_reserve("udp");
+  timeline_thread(udp_timeline);
 #if 0
   // don't remember why i wrote this, but i don't think it's needed with select()
   struct timeval tv;
@@ -119,6 +123,7 @@ static void *udp_main(void *arg) {
     if (ready > 0 && FD_ISSET(sock, &readfds)) {
       ssize_t n = recvfrom(sock, line, sizeof(line), 0, (struct sockaddr *)&client, &client_len);
       if (n > 0) {
+        const uint64_t t = timeline_now();
         line[n] = '\0';
         // printf("# from %d\n", ntohs(client.sin_port)); // port
         // in the future, this should get ip and port and use for
@@ -127,7 +132,14 @@ static void *udp_main(void *arg) {
         if (user[which].w.debug) {
           printf("\r[%d]<%s>\r\n", which, line);
         }
+        const int edits = user[which].w.edits;
         wire(line, &user[which].w);
+        // t is on the same monotonic ns clock, and is when it arrived; only
+        // a datagram that changed what is heard has a latency to measure
+        if (latency_enabled() && user[which].w.edits != edits) {
+          latency_post(which, ntohs(client.sin_port), t, latency_now());
+        }
+        timeline_span(TIMELINE_UDP, t, (int)n);
       } else {
         if (errno == EAGAIN) continue;
       }
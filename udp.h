@@ -2,6 +2,7 @@
 #define _UDP_H_
 
 #define UDP_PORT (60440)
+#define UDP_PORT_MAX (127) // clients, told apart by a hash of address and port
 
 int udp_start(int port);
 void udp_stop(void);
@@ -5,7 +5,9 @@
 #include <wchar.h>
 #else
 #include <pthread.h>
+#include <time.h>
 #endif
+#include "util.h"
 
 void util_set_thread_name(char *s) {
 #ifdef _WIN32
@@ -19,3 +21,20 @@ void util_set_thread_name(char *s) {
 #endif
 #endif
 }
+
+uint64_t util_now(void) {
+#ifdef _WIN32
+  // mingw only has clock_gettime() through winpthreads, go to the source
+  static LARGE_INTEGER frequency;
+  LARGE_INTEGER count;
+  if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&count);
+  const uint64_t f = (uint64_t)frequency.QuadPart;
+  const uint64_t c = (uint64_t)count.QuadPart;
+  return (c / f) * 1000000000ULL + (c % f) * 1000000000ULL / f;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
@@ -1,4 +1,6 @@
 #ifndef _UTIL_H_
 #define _UTIL_H_
+#include <stdint.h>
 void util_set_thread_name(char *s);
+uint64_t util_now(void); // ns, monotonic, the same clock on every thread
 #endif
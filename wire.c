@@ -72,121 +72,16 @@ float voice_pop(voice_stack_t *s) {
   return n;
 }
 
-#include <stdio.h>
-#include <stdint.h>
-
-// TODO, use the voice_record[] array to determine
-// which how many channels and voices to write to the
-// wave file (update the header too)
-
-// TODO at a minimum make cue notes for the voice number
-// and left/right designation to the wave file
-
-// MAYBE store the voice parameters in a cue note?
-// MAYBE store patterns in a cue note?
-// MAYBE store tempo in cue note?
-// MAYBE have a user note for each oscillator that's
-//       stored in a queue note
-// MAYBE have a user note for pattern that's stored in a queue note
-
 #include <math.h>
 
-void save_wav(wire_t *w, char *filename, float *samples, long num_samples, int *record, int max) {
-  int *record_safe;
-
-  record_safe = (int *)malloc(sizeof(int)*max);
-  if (record_safe == NULL) { w->puts("OUCH"); return; } // nowhere to keep state
-  
-  int num_channels = 0;  // 32 pairs = 64 channels
-
-  for (int i = 0; i < max; i++) {
-    record_safe[i] = record[i];
-    if (record[i]) num_channels += 2;
-  }
-
-  if (num_channels == 0) {
-    free(record_safe);
-    return;
-  } // nothing to record
-
-  FILE *f = fopen(filename, "wb");
-  if (!f) {
-    w->puts("# can't open file\n");
-    return;
-  }
-
-  int sample_rate = 44100;
-  int bits_per_sample = 16;
-  int byte_rate = sample_rate * num_channels * bits_per_sample / 8;
-  int block_align = num_channels * bits_per_sample / 8;
-  int data_size = num_samples * block_align;
-    
-  // WAV header
-  fwrite("RIFF", 1, 4, f);
-  uint32_t chunk_size = 36 + data_size;
-  fwrite(&chunk_size, 4, 1, f);
-  fwrite("WAVE", 1, 4, f);
-    
-  // fmt subchunk
-  fwrite("fmt ", 1, 4, f);
-  uint32_t subchunk1_size = 16;
-  fwrite(&subchunk1_size, 4, 1, f);
-  uint16_t audio_format = 1;  // PCM
-  fwrite(&audio_format, 2, 1, f);
-  uint16_t channels = num_channels;
-  fwrite(&channels, 2, 1, f);
-  fwrite(&sample_rate, 4, 1, f);
-  fwrite(&byte_rate, 4, 1, f);
-  uint16_t align = block_align;
-  fwrite(&align, 2, 1, f);
-  uint16_t bps = bits_per_sample;
-  fwrite(&bps, 2, 1, f);
-
-  // data subchunk
-  fwrite("data", 1, 4, f);
-  fwrite(&data_size, 4, 1, f);
-
-  // since skred plays loose and wild with sample ranges,
-  // get the min/max of all the samples in the recorded range
-
-  float fbig = 0.0;
-  float fsmall = 0.0;
-  for (int i = 0; i < num_samples * VOICE_MAX * AUDIO_CHANNELS; i++) {
-    float g = samples[i];
-    if (g > fbig) fbig = g;
-    if (g < fsmall) fsmall = g;
-  }
-
-  // use the min/max to make a scale factor that keeps 0
-  // in the same relative place
-
-  float scale;
-  if (fabsf(fsmall) > fabsf(fbig)) {
-    scale = -1.0f / fsmall;
-  } else {
-    scale = 1.0f / fbig;
-  }
- 
-  // Convert scaled float samples to 16-bit PCM
-
-  for (int i = 0; i < num_samples * VOICE_MAX * AUDIO_CHANNELS; i++) {
-    int ri = (i % (VOICE_MAX * AUDIO_CHANNELS)) >> 1;
-    if (record_safe[ri] == 0) continue; // skip things that aren't recorded
-    float g = samples[i];
-    g *= scale;
-    if (g > 1.0f) g = 1.0f;
-    if (g < -1.0f) g = -1.0f;
-    int16_t sample = (int16_t)(g * 32767.0f);
-    fwrite(&sample, 2, 1, f);
-  }
-
-  fclose(f);
-  free(record_safe);
-}
-
 #include "skred.h"
 #include "synth-types.h"
 #include "synth.h"
+#include "synth-pool.h"
+#include "synth-perf.h"
+#include "timeline.h"
+#include "latency.h"
+#include "rec.h"
 
 #define WIRE_POINTER_MAX (100)
 static wire_t *wl[WIRE_POINTER_MAX];
@@ -242,9 +137,27 @@ void system_show(wire_t *w) {
   w->printf("# udp_port %d\n", udp_info());
 }
 
+#include <sys/time.h>
+#include <unistd.h>
+
+// skred-<pid>-<ms><what>, what being the rest of the name
+static void stamp_name(char *name, const char *what) {
+  pid_t pid = getpid();
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  long long ms = (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#ifdef _WIN32
+  sprintf(name, "skred-%lld-%lld%s", pid, ms, what);
+#else
+  sprintf(name, "skred-%d-%lld%s", pid, ms, what);
+#endif
+}
+
 void show_stats(wire_t *w) {
   // do something useful
-  w->printf("# rec_state : %d rec_ptr %ld\n", rec_state, rec_ptr);
+  w->printf("# recording %d : %llu frames, %llu dropped\n", rec_active(),
+    (unsigned long long)rec_frames(), (unsigned long long)rec_dropped());
+  w->printf("# capture %.1f seconds\n", rec_capture_seconds());
   w->printf("# synth frames per callback %d : %gms\n",
     synth_frames_per_callback, (float)synth_frames_per_callback / (float)MAIN_SAMPLE_RATE * 1000.0f);
   w->printf("# seq frames per callback %d : %gms\n",
@@ -650,7 +563,11 @@ int wire_function(skode_t *s, int info) {
         if (argc > 1) voice_link_midi_b[voice] = (int)arg[1];
       }
       break;
-    case 'h___': if (argc) { voice_sample_hold_max[voice] = x; } break;
+    case 'h___': if (argc) {
+        voice_sample_hold_max[voice] = x;
+        voice_features_update(voice);
+      }
+      break;
     case 'H___': if (argc) {
         voice_link_velo_a[voice] = x;
         if (argc > 1) voice_link_velo_b[voice] = (int)arg[1];
@@ -665,12 +582,14 @@ int wire_function(skode_t *s, int info) {
     case 'L___': if (argc) { voice_link_trig[voice] = x; } break;
     case 'J___': if (argc) {
         voice_filter_mode[voice] = x;
+        voice_features_update(voice);
         mmf_set_params(voice,
           voice_filter_freq[voice],
           voice_filter_res[voice]);
       }
       break;
     case 'K___': if (argc) { mmf_set_freq(voice, arg[0]); } break;
+    case 'k___': if (argc) { control_rate_set(voice, x); } break;
     case 'l___': if (argc) {
         envelope_velocity(voice, arg[0]);
         if (voice_link_velo_a[voice] >= 0) envelope_velocity(voice_link_velo_a[voice], arg[0]);
@@ -686,6 +605,12 @@ int wire_function(skode_t *s, int info) {
       }
       break;
     case 'N___': if (argc) { voice_midi_transpose[voice] = arg[0]; } break;
+    case 'O___': if (argc == 1) {
+        cutoff_mod_set(voice, -1, 0);
+      } else if (argc > 1) {
+        cutoff_mod_set(voice, x, arg[1]);
+      }
+      break;
     case 'p___': if (argc) pan_set(voice, arg[0]); break;
     case 'P___': if (argc <= 1) {
         pan_mod_set(voice, x, -1);
@@ -695,7 +620,13 @@ int wire_function(skode_t *s, int info) {
       break;
     case 'q___': if (argc) { wave_quant(voice, x); } break;
     case 'Q___': if (argc) { mmf_set_res(voice, arg[0]); } break;
-    case 'r___': if (argc) { if (rec_state == 0) voice_record[voice] = x; } break;
+    case 'R___': if (argc == 1) {
+        res_mod_set(voice, -1, 0);
+      } else if (argc > 1) {
+        res_mod_set(voice, x, arg[1]);
+      }
+      break;
+    case 'r___': if (argc) { if (!rec_active()) voice_record[voice] = x; } break;
     case 's___': if (argc) {
         if (arg[0] <= 0) {
           voice_smoother_enable[voice] = 0;
@@ -703,10 +634,15 @@ int wire_function(skode_t *s, int info) {
           voice_smoother_enable[voice] = 1;
           voice_smoother_smoothing[voice] = arg[0];
         }
+        voice_features_update(voice);
       }
       break;
     case 'S___': if (argc) wave_reset(voice, x); break;
-    case 't___': if (argc > 3) envelope_set(voice, arg[0], arg[1], arg[2], arg[3]); break;
+    case 't___': if (argc > 3) {
+        envelope_set(voice, arg[0], arg[1], arg[2], arg[3]);
+        if (argc > 4) envelope_curve(voice, (int)arg[4]);
+      }
+      break;
     case 'T___': {
         voice_trigger(voice);
         if (voice_link_trig[voice] > 0) voice_trigger(voice_link_trig[voice]);
@@ -759,7 +695,18 @@ int wire_function(skode_t *s, int info) {
       break;
     case 'l>g_': if (argc) skode_local_to_global(w->sk, x); break;
     case 'g>l_': if (argc) skode_global_to_local(w->sk, x); break;
-    case '/m__': case ':m__': synth_voice_bench(voice); break;
+    case '/m__': case ':m__': if (argc) {
+        latency_enable(x);
+      } else if (w->output) {
+        char line[256];
+        for (int c = -1; c < LATENCY_CLIENTS; c++) {
+          if (latency_show(c, line, sizeof(line))) w->printf("%s", line);
+        }
+        for (int k = LATENCY_LOG - 1; k >= 0; k--) {
+          if (latency_show_event(k, line, sizeof(line))) w->printf("%s", line);
+        }
+      }
+      break;
     case '/q__': case ':q__': w->quit = -1; return 0;
     case '/d__': case ':d__': if (argc == 0) {
         if (w->debug) w->debug = 0; else w->debug = 1;
@@ -780,6 +727,20 @@ int wire_function(skode_t *s, int info) {
     case '/v__': case ':v__': if (argc == 0) x = (w->verbose) ? 0 : 1;
       w->verbose = x;
       break;
+    case '/c__': case ':c__': if (argc) synth_cost_every = (x > 0) ? x : 0; break;
+    case '/T__': case ':T__': if (argc) {
+        timeline_enable(x);
+      } else {
+        char name[1024];
+        stamp_name(name, "-trace.json");
+        long events = timeline_save(name);
+        if (events >= 0) w->printf("# file %s (%ld events)\n", name, events);
+        else w->printf("# can't write %s\n", name);
+      }
+      break;
+    case '/p__': case ':p__': if (argc == 0) x = !synth_perf_enabled();
+      synth_perf_enable(x);
+      break;
     case '/s__': case ':s__': if (w->output) {
         system_show(w);
         show_threads(w);
@@ -795,7 +756,7 @@ int wire_function(skode_t *s, int info) {
     case '/o__': case ':o__': scope_enable = x; break;
               // sub x for scope_cross = 1
               // sub q for scope_quit = 0
-              // sub 0..VOICE_MAX-1 for scope_channel = n
+              // sub 0..voice_max-1 for scope_channel = n
               // sub -1 for scope_channel = -1 (all channels)
     case '/l__': case ':l__': if (argc) { sk_load(w, voice, x, w->output); } break;
     case '/w__': case ':w__': {
@@ -813,41 +774,40 @@ int wire_function(skode_t *s, int info) {
         wave_load(w, which, where, ch);
       }
       break;
-    case '<___': if (arg) {
-        rec_state = 0;
-        float max_sec = arg[0];
-        float max_samples;
-        if (max_sec > 0.0f) {
-          if (max_sec > rec_sec) {
-            max_sec = rec_sec;
-          }
-          max_samples = max_sec * (float)(MAIN_SAMPLE_RATE * AUDIO_CHANNELS * VOICE_MAX);
-          rec_max = max_samples;
+    case '<___': {
+        // <seconds,bits, at most that long (0 or none for no limit), float
+        // unless bits is 24
+        const float seconds = (argc > 0 && arg[0] > 0.0f) ? arg[0] : 0.0f;
+        int bits = REC_FLOAT;
+        if (argc > 1) bits = (int)arg[1];
+        if (bits != REC_FLOAT && bits != REC_PCM24) {
+          w->printf("# can't record %d bit, <seconds,24 or <seconds,32\n", bits);
+          break;
         }
-        rec_ptr = 0;
-        rec_state = 1;
-      }
-      break;
-    case '*___': {
-        #include <sys/time.h>
-        #include <unistd.h>
-        if (rec_ptr) {
-          rec_state = 0;
-          pid_t pid = getpid();
-          struct timeval tv;
-          gettimeofday(&tv, NULL);
-          long long ms = (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
-          char name[1024];
-#ifdef _WIN32
-          sprintf(name, "skred-%lld-%lld.wav", pid, ms);
-#else
-          sprintf(name, "skred-%d-%lld.wav", pid, ms);
-#endif
-          w->printf("# file %s (%ld frames)\n", name, rec_ptr);
-          save_wav(w, name, recording, rec_ptr/VOICE_MAX/AUDIO_CHANNELS, voice_record, VOICE_MAX);
+        char name[1024];
+        stamp_name(name, ".wav");
+        int channels = rec_start(name, bits, seconds);
+        if (channels == 0) {
+          w->printf("# no voices to record, mark them with r1\n");
+        } else if (channels > 0 && seconds > 0.0f) {
+          w->printf("# file %s (%d channels, %s, %g seconds)\n", name, channels, (bits == REC_PCM24) ? "24 bit" : "float", seconds);
+        } else if (channels > 0) {
+          w->printf("# file %s (%d channels, %s)\n", name, channels, (bits == REC_PCM24) ? "24 bit" : "float");
         }
       }
       break;
+    case '*___':
+      if (argc == 0 && rec_active()) {
+        long frames = rec_stop();
+        if (frames >= 0) w->printf("# recorded %ld frames\n", frames);
+      } else {
+        // the last x seconds of the master capture, all of it without
+        char name[1024];
+        stamp_name(name, "-master.wav");
+        long frames = rec_capture_save(name, argc ? x : 0);
+        if (frames > 0) w->printf("# file %s (%.1f seconds)\n", name, (float)frames / (float)MAIN_SAMPLE_RATE);
+      }
+      break;
     case '>___': if (arg) voice_copy(voice, x); break;
     case '/___': wave_default(voice); break;
     case '%___': if (arg) seq_modulo_set(w->pattern, x); break;
@@ -904,10 +864,30 @@ int wire_unknown(wire_t *w, skode_t *s, int info) {
   return 0;
 }
 
+// does the atom change what the voices play, rather than select, show,
+// save, or drive the patterns and the session
+static int wire_audible(int atom) {
+  switch ((atom >> 24) & 0xff) {
+    case ':': case '?': case '\\': case '<': case '*': case '=':
+    case '%': case '!': case '@':
+      return 0;
+    case '/': return atom == '/___';
+  }
+  switch (atom) {
+    case 'v___': case 'W___': case 'D___':
+    case 'x___': case 'y___': case 'z___': case 'Z___':
+    case 'l>g_': case 'g>l_':
+      return 0;
+  }
+  return 1;
+}
+
 int wire_cb(skode_t *s, int info) {
   wire_t *w = (wire_t*)skode_user(s);
   switch (info) {
-    case FUNCTION: return wire_function(s, info);
+    case FUNCTION:
+      if (wire_audible(skode_atom_num(s))) w->edits++;
+      return wire_function(s, info);
     case DEFER: return wire_defer(s, info);
     case CHUNK_END: return wire_chunk_end(s, info);
     case PUSH: { voice_push(&w->stack, w->voice); w->printf("pushed v%d\n", w->voice); } break;
@@ -933,7 +913,10 @@ int wire(char *line, wire_t *w) {
 
   int r = 0;
 
+  const uint64_t t = timeline_start();
+  const int length = (int)strlen(line);
   skode(w->sk, line, wire_cb);
+  timeline_span(TIMELINE_WIRE, t, length);
   return w->quit;
   return r;
 }
@@ -945,10 +928,9 @@ int audio_show(wire_t *w) {
     wire_init(w);
   }
   w->printf("# synth backend is running\n");
-  w->printf("# synth total voice count %d\n", VOICE_MAX);
-  int active = 0;
-  for (int i = 0; i < VOICE_MAX; i++) if (voice_amp[i] != 0) active++;
-  w->printf("# synth active voice count %d\n", active);
+  w->printf("# synth total voice count %d\n", voice_max);
+  w->printf("# synth active voice count %d\n", synth_active_count());
+  w->printf("# synth render threads %d\n", synth_pool_threads());
 #ifdef _WIN32
   w->printf("# synth sample count %lld\n", synth_sample_count);
 #else
@@ -979,6 +961,7 @@ void wire_init(wire_t *w) {
   w->verbose = 0;
   w->scratch[0] = '\0';
   w->events = 0;
+  w->edits = 0;
   w->sk = NULL;
   w->quit = 0;
   w->puts = wire_puts;
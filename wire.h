@@ -54,6 +54,7 @@ typedef struct {
   int trace;
   int verbose;
   int events; // do incoming events go to the logger?
+  int edits;  // immediate commands that changed what is heard, for latency
   skode_t *sk;
   int quit;
   int (*puts)(const char *s);
@@ -206,6 +207,7 @@ int null_printf(const char *fmt, ...);
   .verbose = 0, \
   .scratch[0] = '\0', \
   .events = 0, \
+  .edits = 0, \
   .sk = NULL, \
   .quit = 0, \
   .puts = wire_puts, \